@@ -0,0 +1,383 @@
+//
+//  Bench.cpp
+//  EADS micro-benchmarks
+//
+//  Runs insert, lookup, remove, copy, concatenate and clear workloads on
+//  Sequence (Lab1), Ring (Lab2) and Dictionary (Lab3) for int and string keys,
+//  uniform, sorted and Zipfian key patterns and sizes from 10^3 to 10^7, and
+//  writes one JSON record per run: ns/op, allocations/op and peak RSS.
+//
+//  Built by the Bench target of CMakeLists.txt, or g++ -std=c++17 -O2 Bench.cpp -o Bench
+//  Bench [--min-size N] [--max-size N] [--only Sequence|Ring|Dictionary] > results.json
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#include "Dictionary.h"
+#include "Ring.h"
+#include "Sequence.h"
+using namespace std;
+using namespace eads;
+
+// Every allocation of the process goes through these, so a run's allocation count is
+// the difference of the counter around its timed part
+static atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+// GCC pairs the inlined free() with the new-expressions it came from and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void* p, size_t) noexcept {
+    ::operator delete(p);
+}
+
+// Peak resident set size in KiB. On Linux the peak is reset before every run, so it is the
+// peak of that run (including its setup); elsewhere it is the peak of the process so far.
+static long peakRssKb() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+static void resetPeakRss() {
+#ifdef __linux__
+    if (FILE* f = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+enum class Pattern { Uniform, Sorted, Zipfian };
+
+static const char* patternName(Pattern pattern) {
+    switch (pattern) {
+        case Pattern::Uniform: return "uniform";
+        case Pattern::Sorted: return "sorted";
+        default: return "zipfian";
+    }
+}
+
+// Distinct keys: multiplying by an odd constant permutes 32-bit integers
+template<typename Key>
+Key makeKey(uint32_t i);
+
+template<>
+int makeKey<int>(uint32_t i) {
+    return (int)(i * 2654435761u);
+}
+
+template<>
+string makeKey<string>(uint32_t i) {
+    return "key:" + to_string(i * 2654435761u);
+}
+
+template<typename Key>
+const char* keyName();
+
+template<>
+const char* keyName<int>() {
+    return "int";
+}
+
+template<>
+const char* keyName<string>() {
+    return "string";
+}
+
+// Keys of a run: the n distinct keys in the order inserts and removes visit them, and
+// the stream of lookups. Sorted visits keys in ascending order; uniform in random order;
+// Zipfian (s = 0.99) makes a few keys hot: lookups repeat them, inserts and removes
+// reach them first.
+template<typename Key>
+struct KeySet {
+    vector<Key> order;
+    vector<Key> lookups;
+
+    KeySet(size_t n, size_t lookupCount, Pattern pattern, uint64_t seed) {
+        mt19937_64 rng(seed);
+        order.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            order.push_back(makeKey<Key>((uint32_t)i));
+        }
+        if (pattern == Pattern::Sorted) {
+            sort(order.begin(), order.end());
+        }
+        else {
+            shuffle(order.begin(), order.end(), rng);
+        }
+        lookups.reserve(lookupCount);
+        if (pattern == Pattern::Sorted) {
+            for (size_t j = 0; j < lookupCount; ++j) {
+                lookups.push_back(order[j % n]);
+            }
+        }
+        else if (pattern == Pattern::Uniform) {
+            for (size_t j = 0; j < lookupCount; ++j) {
+                lookups.push_back(order[rng() % n]);
+            }
+        }
+        else {
+            // order[r] has popularity rank r; lookups invert the continuous Zipf CDF
+            const double s = 0.99;
+            uniform_real_distribution<double> unit(0.0, 1.0);
+            double top = pow((double)n + 1, 1 - s) - 1;
+            for (size_t j = 0; j < lookupCount; ++j) {
+                size_t rank = (size_t)pow(top * unit(rng) + 1, 1 / (1 - s)) - 1;
+                lookups.push_back(order[min(rank, n - 1)]);
+            }
+            // Weighted sampling without replacement: rank r gets the sort key Exp(1) * r^s
+            exponential_distribution<double> exp1(1.0);
+            vector<pair<double, size_t>> weighted(n);
+            for (size_t r = 0; r < n; ++r) {
+                weighted[r] = make_pair(exp1(rng) * pow((double)(r + 1), s), r);
+            }
+            sort(weighted.begin(), weighted.end());
+            vector<Key> hotFirst;
+            hotFirst.reserve(n);
+            for (const pair<double, size_t>& w : weighted) {
+                hotFirst.push_back(order[w.second]);
+            }
+            order.swap(hotFirst);
+        }
+    }
+};
+
+// The same operations on every container. Operations marked linear take O(n) each,
+// so the harness times fewer of them on large containers.
+template<typename Key>
+struct SequenceBench {
+    static constexpr const char* name = "Sequence";
+    static constexpr bool linearLookup = true;
+    static constexpr bool linearRemove = true;
+    static constexpr bool quadraticBuild = false;
+
+    Sequence<Key, int> c;
+
+    void insert(const Key& k) { c.PushBack(k, 0); }
+    bool lookup(const Key& k) const { return c.Contains(k); }
+    void remove(const Key& k) { c.Remove(k); }
+    void clear() { c.Clear(); }
+    void concat(const SequenceBench& a, const SequenceBench& b) {
+        c += a.c;
+        c += b.c;
+    }
+};
+
+template<typename Key>
+struct RingBench {
+    static constexpr const char* name = "Ring";
+    static constexpr bool linearLookup = true;
+    static constexpr bool linearRemove = true;
+    // insert() checks the whole ring for the key, so building takes O(n^2)
+    static constexpr bool quadraticBuild = true;
+
+    Ring<Key, int> c;
+
+    void insert(const Key& k) { c.insert(k, 0); }
+    bool lookup(const Key& k) const { return c.exists(k); }
+    void remove(const Key& k) { c.remove(k); }
+    void clear() { c.clear(); }
+    void concat(const RingBench& a, const RingBench& b) {
+        c.copyFrom(a.c);
+        c.copyFrom(b.c);
+    }
+};
+
+template<typename Key>
+struct DictionaryBench {
+    static constexpr const char* name = "Dictionary";
+    static constexpr bool linearLookup = false;
+    static constexpr bool linearRemove = false;
+    static constexpr bool quadraticBuild = false;
+
+    Dictionary<Key, int> c;
+
+    void insert(const Key& k) { c.insert(k, 0); }
+    bool lookup(const Key& k) const { return c.hasKey(k); }
+    void remove(const Key& k) { c.remove(k); }
+    void clear() { c.clear(); }
+    void concat(const DictionaryBench& a, const DictionaryBench& b) {
+        c = a.c;
+        c.merge(b.c);
+    }
+};
+
+// Writes the JSON document one record at a time, so an interrupted run keeps its results
+class Report {
+public:
+    explicit Report(ostream& os) : os(os), first(true) {
+        os << "{\"benchmark\": \"eads\", \"runs\": [";
+    }
+
+    ~Report() {
+        os << "\n]}" << endl;
+    }
+
+    void record(const char* container, const char* key, Pattern pattern, size_t size, const char* op,
+            size_t ops, double seconds, size_t allocs) {
+        os << (first ? "\n" : ",\n") << "  {\"container\": \"" << container << "\", \"key\": \"" << key
+           << "\", \"pattern\": \"" << patternName(pattern) << "\", \"size\": " << size << ", \"op\": \"" << op
+           << "\", \"ops\": " << ops << ", \"ns_per_op\": " << seconds * 1e9 / (double)ops
+           << ", \"allocs_per_op\": " << (double)allocs / (double)ops << ", \"peak_rss_kb\": " << peakRssKb() << "}";
+        os.flush();
+        first = false;
+    }
+
+private:
+    ostream& os;
+    bool first;
+};
+
+// Element visits allowed for the timed part of a linear operation
+static const size_t linearBudget = 50000000;
+
+// How many of n operations to time when each costs O(n) if linear
+static size_t timedOps(size_t n, bool linear) {
+    return linear ? max((size_t)1, min(n, linearBudget / n)) : n;
+}
+
+// Times f(), which runs ops operations, and records it with its allocations
+template<typename F>
+void measure(Report& report, const char* container, const char* key, Pattern pattern, size_t size,
+        const char* op, size_t ops, F f) {
+    size_t allocsBefore = allocations.load(memory_order_relaxed);
+    auto start = chrono::steady_clock::now();
+    f();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t allocs = allocations.load(memory_order_relaxed) - allocsBefore;
+    report.record(container, key, pattern, size, op, ops, seconds, allocs);
+}
+
+template<typename Bench, typename Key>
+void run(Report& report, size_t n, Pattern pattern) {
+    const char* key = keyName<Key>();
+    KeySet<Key> keys(n, timedOps(n, Bench::linearLookup), pattern, n * 31 + (size_t)pattern);
+    auto build = [&](Bench& b, size_t first, size_t last) {
+        for (size_t j = first; j < last; ++j) {
+            b.insert(keys.order[j]);
+        }
+    };
+
+    resetPeakRss();
+    {
+        unique_ptr<Bench> b(new Bench());
+        measure(report, Bench::name, key, pattern, n, "insert", n, [&]() { build(*b, 0, n); });
+
+        size_t hits = 0;
+        measure(report, Bench::name, key, pattern, n, "lookup", keys.lookups.size(), [&]() {
+            for (const Key& k : keys.lookups) {
+                hits += b->lookup(k);
+            }
+        });
+        if (hits != keys.lookups.size()) {
+            throw runtime_error("Lookups missed inserted keys");
+        }
+
+        unique_ptr<Bench> copy(new Bench());
+        measure(report, Bench::name, key, pattern, n, "copy", n, [&]() { copy->c = b->c; });
+
+        size_t removes = timedOps(n, Bench::linearRemove);
+        measure(report, Bench::name, key, pattern, n, "remove", removes, [&]() {
+            for (size_t j = 0; j < removes; ++j) {
+                b->remove(keys.order[j]);
+            }
+        });
+
+        measure(report, Bench::name, key, pattern, n, "clear", n, [&]() { copy->clear(); });
+    }
+
+    resetPeakRss();
+    {
+        unique_ptr<Bench> left(new Bench());
+        unique_ptr<Bench> right(new Bench());
+        build(*left, 0, n / 2);
+        build(*right, n / 2, n);
+        unique_ptr<Bench> joined(new Bench());
+        measure(report, Bench::name, key, pattern, n, "concat", n, [&]() { joined->concat(*left, *right); });
+    }
+}
+
+template<template<typename> class Bench>
+void runAll(Report& report, size_t minSize, size_t maxSize) {
+    // Ring takes O(n^2) to build, so it stops at 10^4 entries
+    size_t limit = Bench<int>::quadraticBuild ? min(maxSize, (size_t)10000) : maxSize;
+    for (size_t n = minSize; n <= limit; n *= 10) {
+        for (Pattern pattern : { Pattern::Uniform, Pattern::Sorted, Pattern::Zipfian }) {
+            run<Bench<int>, int>(report, n, pattern);
+            run<Bench<string>, string>(report, n, pattern);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t minSize = 1000;
+    size_t maxSize = 10000000;
+    string only;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--min-size") == 0) {
+            minSize = max((size_t)1, (size_t)stoull(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--max-size") == 0) {
+            maxSize = (size_t)stoull(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--only") == 0) {
+            only = argv[i + 1];
+        }
+    }
+
+    Report report(cout);
+    if (only.empty() || only == "Sequence") {
+        runAll<SequenceBench>(report, minSize, maxSize);
+    }
+    if (only.empty() || only == "Ring") {
+        runAll<RingBench>(report, minSize, maxSize);
+    }
+    if (only.empty() || only == "Dictionary") {
+        runAll<DictionaryBench>(report, minSize, maxSize);
+    }
+#ifdef EADS_LATENCY
+    // Built with the timing layer: the per-operation percentiles go next to the JSON
+    dumpLatency(cerr);
+#endif
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef EADS_CONCURRENT_DICTIONARY_H
+#define EADS_CONCURRENT_DICTIONARY_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include "Dictionary.h"
+
+namespace eads {
+
+// A thread-safe dictionary which hash-partitions keys across independently
+// locked Dictionary shards. Lookups take a shared lock, so readers only wait
+// for a writer holding the same shard.
+template<typename Key, typename Info, typename Compare = std::less<>, typename Hash = std::hash<Key>>
+class ConcurrentDictionary {
+public:
+    explicit ConcurrentDictionary(size_t shardCount = 64)
+        : count_(std::max(shardCount, (size_t)1)), shards(new Shard[count_])
+    {
+    }
+
+    ConcurrentDictionary(const ConcurrentDictionary&) = delete;
+    ConcurrentDictionary& operator =(const ConcurrentDictionary&) = delete;
+
+    size_t shardCount() const {
+        return count_;
+    }
+
+    // Sums the shards one at a time, so it is not a snapshot under concurrent writes
+    int count() const {
+        int result = 0;
+        for (size_t s = 0; s < count_; ++s) {
+            std::shared_lock<std::shared_mutex> lock(shards[s].lock);
+            result += shards[s].dict.count();
+        }
+        return result;
+    }
+
+    void clear() {
+        for (size_t s = 0; s < count_; ++s) {
+            std::unique_lock<std::shared_mutex> lock(shards[s].lock);
+            shards[s].dict.clear();
+        }
+    }
+
+    void insert(const Key& k, const Info& i) {
+        Shard& shard = shardOf(k);
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+        shard.dict.insert(k, i);
+    }
+
+    // Inserts unless the key is already present, atomically with respect to other writers
+    bool tryInsert(const Key& k, const Info& i) {
+        Shard& shard = shardOf(k);
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+        if (shard.dict.hasKey(k)) {
+            return false;
+        }
+        shard.dict.insert(k, i);
+        return true;
+    }
+
+    // Inserts (key, info) pairs, locking every affected shard only once.
+    // A duplicate key throws; entries of shards processed before it stay inserted.
+    template<typename Iter>
+    void insertBatch(Iter first, Iter last) {
+        std::vector<std::vector<Iter>> groups(count_);
+        for (; first != last; ++first) {
+            groups[shardIndex(first->first)].push_back(first);
+        }
+        for (size_t s = 0; s < count_; ++s) {
+            if (!groups[s].empty()) {
+                std::unique_lock<std::shared_mutex> lock(shards[s].lock);
+                for (const Iter& it : groups[s]) {
+                    shards[s].dict.insert(it->first, it->second);
+                }
+            }
+        }
+    }
+
+    template<typename Range>
+    void insertBatch(const Range& range) {
+        insertBatch(std::begin(range), std::end(range));
+    }
+
+    void remove(const Key& k) {
+        Shard& shard = shardOf(k);
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+        shard.dict.remove(k);
+    }
+
+    bool hasKey(const Key& k) const {
+        const Shard& shard = shardOf(k);
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        return shard.dict.hasKey(k);
+    }
+
+    bool tryGetInfo(const Key& k, Info& i) const {
+        const Shard& shard = shardOf(k);
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        return shard.dict.tryGetInfo(k, i);
+    }
+
+    // Returns a copy, since a reference would outlive the shard lock
+    Info getInfo(const Key& k) const {
+        Info i;
+        if (!tryGetInfo(k, i)) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return i;
+    }
+
+private:
+    // Every shard sits on its own cache lines so that locking one does not slow its neighbours
+    struct alignas(64) Shard {
+        mutable std::shared_mutex lock;
+        Dictionary<Key, Info, Compare> dict;
+    };
+
+    size_t shardIndex(const Key& k) const {
+        // Fibonacci hashing spreads identity hashes (e.g. of integers) over all shards
+        uint64_t h = (uint64_t)hasher(k) * 0x9E3779B97F4A7C15ull;
+        return (size_t)((h >> 32) % count_);
+    }
+
+    Shard& shardOf(const Key& k) {
+        return shards[shardIndex(k)];
+    }
+
+    const Shard& shardOf(const Key& k) const {
+        return shards[shardIndex(k)];
+    }
+
+    size_t count_;
+    std::unique_ptr<Shard[]> shards;
+    Hash hasher;
+};
+
+}
+
+#endif
@@ -0,0 +1,2909 @@
+#ifndef EADS_DICTIONARY_H
+#define EADS_DICTIONARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EADS_HAVE_MMAP 1
+#endif
+#include "InlineStorage.h"
+#include "KeyTraits.h"
+#include "Latency.h"
+#include "Stats.h"
+#include "TaskPool.h"
+
+namespace eads {
+
+// What Dictionary::unionWith() keeps when both dictionaries have the key
+enum class ConflictPolicy { KeepOurs, KeepTheirs, Forbid };
+
+// How the Dictionary set operations run. Linear streams both trees in key order
+// and rebuilds a balanced tree in O(n + m). Join splits the larger tree by the
+// keys of the smaller one, O(m log(n / m + 1)); ParallelJoin also runs the two
+// halves of every large split on separate threads. Auto picks by input sizes.
+enum class SetAlgorithm { Auto, Linear, Join, ParallelJoin };
+
+// Output of Dictionary::exportTree(): one line per level, a Graphviz digraph, or a JSON node list
+enum class TreeFormat { Text, Dot, Json };
+
+// What Dictionary::exportTree() writes; the root is at depth 0
+struct TreeExport {
+    TreeFormat format = TreeFormat::Text;
+    int maxDepth = std::numeric_limits<int>::max();
+    size_t maxNodes = std::numeric_limits<size_t>::max();
+};
+
+// Tag for the constructors which take (key, info) pairs already sorted by key
+struct SortedInput { };
+constexpr SortedInput sortedInput { };
+
+// Balancing policies for Dictionary. A policy keeps its per-node state in
+// NodeData and restores its invariant with the tree's rotations:
+//   fixInsert(t, n)                after a key was inserted below n
+//   removed(n, state)              when remove() unlinks the leaf n
+//   fixRemove(t, n, left, state)   after a key was removed from the left (or right) subtree of n
+//   fixRoot(root)                  after every insert or remove, for the whole tree
+//   built(n, depth, total)         for every node of a tree built by a balanced in-order build
+//   join(t, l, k, r)               links the trees l < k < r into one tree
+//   holds(t, root)                 whether the invariant holds for the tree, for tests
+
+// Heights of the two subtrees differ by at most one; at most two rotations per
+// insert, O(log n) per remove. The lowest trees, so the fastest lookups.
+struct AvlBalance {
+    struct NodeData { };
+    struct RemoveState { };
+
+    template<typename Tree, typename Node>
+    static Node* fixInsert(Tree& t, Node* n) {
+        return rebalance(t, n);
+    }
+
+    template<typename Node>
+    static void removed(Node*, RemoveState&) { }
+
+    template<typename Tree, typename Node>
+    static Node* fixRemove(Tree& t, Node* n, bool, RemoveState&) {
+        return rebalance(t, n);
+    }
+
+    template<typename Node>
+    static Node* fixRoot(Node* root) {
+        return root;
+    }
+
+    template<typename Node>
+    static void built(Node*, int, size_t) { }
+
+    // O(|height(l) - height(r)|)
+    template<typename Tree, typename Node>
+    static Node* join(Tree& t, Node* l, Node* k, Node* r) {
+        if (t.getHeight(l) > t.getHeight(r) + 1) {
+            Node* c = join(t, l->nodeR, k, r);
+            l->nodeR = c;
+            c->parent = l;
+            t.update(l);
+            return rebalance(t, l);
+        }
+        if (t.getHeight(r) > t.getHeight(l) + 1) {
+            Node* c = join(t, l, k, r->nodeL);
+            r->nodeL = c;
+            c->parent = r;
+            t.update(r);
+            return rebalance(t, r);
+        }
+        t.link(k, l, r);
+        return k;
+    }
+
+    template<typename Tree, typename Node>
+    static bool holds(Tree& t, const Node* n) {
+        return n == nullptr || (std::abs(getBalance(t, n)) <= 1 && holds(t, n->nodeL) && holds(t, n->nodeR));
+    }
+
+private:
+    template<typename Tree, typename Node>
+    static int getBalance(Tree& t, Node* n) {
+        if (n == nullptr) {
+            return 0;
+        }
+        return t.getHeight(n->nodeL) - t.getHeight(n->nodeR);
+    }
+
+    // Restores the AVL invariant at n with at most two rotations
+    template<typename Tree, typename Node>
+    static Node* rebalance(Tree& t, Node* n) {
+        int balance = getBalance(t, n);
+
+        if (balance > 1) {
+            if (getBalance(t, n->nodeL) < 0) {
+                n->nodeL = t.rotateL(n->nodeL);
+            }
+            return t.rotateR(n);
+        }
+        if (balance < -1) {
+            if (getBalance(t, n->nodeR) > 0) {
+                n->nodeR = t.rotateR(n->nodeR);
+            }
+            return t.rotateL(n);
+        }
+
+        return n;
+    }
+};
+
+// Red-black tree: no red node has a red child and every path down from a node
+// passes the same number of black nodes. At most two rotations per insert and
+// three per remove, in exchange for trees up to twice the minimal height.
+struct RedBlackBalance {
+    struct NodeData {
+        bool red = true;
+    };
+
+    // Set while the subtree just left by remove() has one black node too few on its paths
+    struct RemoveState {
+        bool shrunk = false;
+    };
+
+    // Fixes a red child with a red child below n, either by pushing n's blackness
+    // down to both children or by rotating the red pair under a black node
+    template<typename Tree, typename Node>
+    static Node* fixInsert(Tree& t, Node* n) {
+        Node* l = n->nodeL;
+        Node* r = n->nodeR;
+        if (isRed(l) && isRed(r)) {
+            if (hasRedChild(l) || hasRedChild(r)) {
+                n->data.red = true;
+                l->data.red = false;
+                r->data.red = false;
+            }
+            return n;
+        }
+        if (isRed(l) && hasRedChild(l)) {
+            if (isRed(l->nodeR)) {
+                n->nodeL = t.rotateL(l);
+            }
+            n = t.rotateR(n);
+        }
+        else if (isRed(r) && hasRedChild(r)) {
+            if (isRed(r->nodeL)) {
+                n->nodeR = t.rotateR(r);
+            }
+            n = t.rotateL(n);
+        }
+        else {
+            return n;
+        }
+        n->data.red = false;
+        n->nodeL->data.red = true;
+        n->nodeR->data.red = true;
+        return n;
+    }
+
+    template<typename Node>
+    static void removed(Node* n, RemoveState& state) {
+        state.shrunk = !n->data.red;
+    }
+
+    template<typename Tree, typename Node>
+    static Node* fixRemove(Tree& t, Node* n, bool left, RemoveState& state) {
+        if (!state.shrunk) {
+            return n;
+        }
+        Node* x = left ? n->nodeL : n->nodeR;
+        if (isRed(x)) {
+            x->data.red = false;
+            state.shrunk = false;
+            return n;
+        }
+        Node* s = left ? n->nodeR : n->nodeL;
+        if (isRed(s)) {
+            // Rotates the red sibling above n; n turns red, so fixing it again ends the repair
+            Node* top = left ? t.rotateL(n) : t.rotateR(n);
+            top->data.red = false;
+            n->data.red = true;
+            Node* fixed = fixRemove(t, n, left, state);
+            (left ? top->nodeL : top->nodeR) = fixed;
+            fixed->parent = top;
+            t.update(top);
+            return top;
+        }
+        Node* nearChild = left ? s->nodeL : s->nodeR;
+        Node* farChild = left ? s->nodeR : s->nodeL;
+        if (!isRed(nearChild) && !isRed(farChild)) {
+            // Takes one black node off the sibling's paths too and passes the shortage up
+            s->data.red = true;
+            if (n->data.red) {
+                n->data.red = false;
+                state.shrunk = false;
+            }
+            return n;
+        }
+        if (!isRed(farChild)) {
+            s = left ? t.rotateR(s) : t.rotateL(s);
+            (left ? n->nodeR : n->nodeL) = s;
+            s->data.red = false;
+            farChild = left ? s->nodeR : s->nodeL;
+            farChild->data.red = true;
+        }
+        Node* top = left ? t.rotateL(n) : t.rotateR(n);
+        top->data.red = n->data.red;
+        n->data.red = false;
+        farChild->data.red = false;
+        state.shrunk = false;
+        return top;
+    }
+
+    template<typename Node>
+    static Node* fixRoot(Node* root) {
+        if (root != nullptr) {
+            root->data.red = false;
+        }
+        return root;
+    }
+
+    // The balanced build leaves all leaves on the last two levels; an incomplete last level is red
+    template<typename Node>
+    static void built(Node* n, int depth, size_t total) {
+        n->data.red = (total & (total + 1)) != 0 && (size_t)1 << depth > total / 2;
+    }
+
+    // Descends the spine of the taller tree to a black node of the other's black height.
+    // Finding the black heights takes O(log n), so a split costs O(log^2 n).
+    template<typename Tree, typename Node>
+    static Node* join(Tree& t, Node* l, Node* k, Node* r) {
+        fixRoot(l);
+        fixRoot(r);
+        int hl = blackHeight(l);
+        int hr = blackHeight(r);
+        Node* result;
+        if (hl > hr) {
+            result = joinRight(t, l, k, r, hl, hr);
+        }
+        else if (hr > hl) {
+            result = joinLeft(t, l, k, r, hl, hr);
+        }
+        else {
+            k->data.red = true;
+            t.link(k, l, r);
+            result = k;
+        }
+        return fixRoot(result);
+    }
+
+    template<typename Tree, typename Node>
+    static bool holds(Tree&, const Node* root) {
+        return !isRed(root) && checkedBlackHeight(root) >= 0;
+    }
+
+private:
+    template<typename Node>
+    static bool isRed(const Node* n) {
+        return n != nullptr && n->data.red;
+    }
+
+    template<typename Node>
+    static bool hasRedChild(const Node* n) {
+        return isRed(n->nodeL) || isRed(n->nodeR);
+    }
+
+    template<typename Node>
+    static int blackHeight(const Node* n) {
+        int h = 0;
+        for (; n != nullptr; n = n->nodeL) {
+            h += isRed(n) ? 0 : 1;
+        }
+        return h;
+    }
+
+    // Black height of the subtree of n, or -1 if its paths differ in it or a red node has a red child
+    template<typename Node>
+    static int checkedBlackHeight(const Node* n) {
+        if (n == nullptr) {
+            return 0;
+        }
+        int l = checkedBlackHeight(n->nodeL);
+        int r = checkedBlackHeight(n->nodeR);
+        if (l < 0 || l != r || (isRed(n) && hasRedChild(n))) {
+            return -1;
+        }
+        return l + (isRed(n) ? 0 : 1);
+    }
+
+    template<typename Tree, typename Node>
+    static Node* joinRight(Tree& t, Node* l, Node* k, Node* r, int hl, int hr) {
+        if (!isRed(l) && hl == hr) {
+            k->data.red = true;
+            t.link(k, l, r);
+            return k;
+        }
+        Node* c = joinRight(t, l->nodeR, k, r, isRed(l) ? hl : hl - 1, hr);
+        l->nodeR = c;
+        c->parent = l;
+        t.update(l);
+        if (!isRed(l) && isRed(c) && isRed(c->nodeR)) {
+            c->nodeR->data.red = false;
+            return t.rotateL(l);
+        }
+        return l;
+    }
+
+    template<typename Tree, typename Node>
+    static Node* joinLeft(Tree& t, Node* l, Node* k, Node* r, int hl, int hr) {
+        if (!isRed(r) && hl == hr) {
+            k->data.red = true;
+            t.link(k, l, r);
+            return k;
+        }
+        Node* c = joinLeft(t, l, k, r->nodeL, hl, isRed(r) ? hr : hr - 1);
+        r->nodeL = c;
+        c->parent = r;
+        t.update(r);
+        if (!isRed(r) && isRed(c) && isRed(c->nodeL)) {
+            c->nodeL->data.red = false;
+            return t.rotateR(r);
+        }
+        return r;
+    }
+};
+
+// Treap: a search tree by key and a max-heap by random priority, so its shape is
+// that of a tree built in random order: expected O(log n) height, fewer than two
+// rotations per insert on average, none on remove, and the simplest join and split.
+struct TreapBalance {
+    struct NodeData {
+        uint32_t priority = nextPriority();
+    };
+
+    struct RemoveState { };
+
+    // Only the child on the insert path can outrank n
+    template<typename Tree, typename Node>
+    static Node* fixInsert(Tree& t, Node* n) {
+        if (priorityOf(n->nodeL) > n->data.priority) {
+            return t.rotateR(n);
+        }
+        if (priorityOf(n->nodeR) > n->data.priority) {
+            return t.rotateL(n);
+        }
+        return n;
+    }
+
+    template<typename Node>
+    static void removed(Node*, RemoveState&) { }
+
+    // remove() moves keys into nodes which keep their priority, so the heap order holds
+    template<typename Tree, typename Node>
+    static Node* fixRemove(Tree&, Node* n, bool, RemoveState&) {
+        return n;
+    }
+
+    template<typename Node>
+    static Node* fixRoot(Node* root) {
+        return root;
+    }
+
+    // Children are built first; a parent draws a new priority, but no lower than theirs
+    template<typename Node>
+    static void built(Node* n, int, size_t) {
+        n->data.priority = std::max(nextPriority(), std::max(priorityOf(n->nodeL), priorityOf(n->nodeR)));
+    }
+
+    // k sinks to the depth its priority belongs at, O(height)
+    template<typename Tree, typename Node>
+    static Node* join(Tree& t, Node* l, Node* k, Node* r) {
+        uint32_t p = k->data.priority;
+        if (p >= priorityOf(l) && p >= priorityOf(r)) {
+            t.link(k, l, r);
+            return k;
+        }
+        if (priorityOf(l) > priorityOf(r)) {
+            Node* c = join(t, l->nodeR, k, r);
+            l->nodeR = c;
+            c->parent = l;
+            t.update(l);
+            return l;
+        }
+        Node* c = join(t, l, k, r->nodeL);
+        r->nodeL = c;
+        c->parent = r;
+        t.update(r);
+        return r;
+    }
+
+    template<typename Tree, typename Node>
+    static bool holds(Tree& t, const Node* n) {
+        return n == nullptr || (priorityOf(n->nodeL) <= n->data.priority && priorityOf(n->nodeR) <= n->data.priority
+            && holds(t, n->nodeL) && holds(t, n->nodeR));
+    }
+
+private:
+    template<typename Node>
+    static uint32_t priorityOf(const Node* n) {
+        return n == nullptr ? 0 : n->data.priority;
+    }
+
+    // xorshift64, seeded per thread
+    static uint32_t nextPriority() {
+        thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 32);
+    }
+};
+
+template<typename Key, typename Info, typename Compare, typename Balance, size_t N>
+class Dictionary;
+
+// Allocates on cache-line boundaries, for the key array of FrozenDictionary
+template<typename T>
+struct CacheLineAllocator {
+    using value_type = T;
+
+    CacheLineAllocator() = default;
+
+    template<typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) { }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(64)));
+    }
+
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(64));
+    }
+
+    template<typename U>
+    bool operator ==(const CacheLineAllocator<U>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator !=(const CacheLineAllocator<U>&) const {
+        return false;
+    }
+};
+
+// An immutable, read-only index produced by Dictionary::freeze().
+// Keys are stored in a single array in Eytzinger (breadth-first) order, so the
+// first levels of every search share a few cache lines and the search loop has
+// no data-dependent branches; the cache line of the descendants 3 or 4 levels
+// down is prefetched.
+template<typename Key, typename Info, typename Compare = std::less<>>
+class FrozenDictionary {
+public:
+    FrozenDictionary() { }
+
+    int count() const {
+        return (int)infos.size();
+    }
+
+    template<typename K>
+    bool hasKey(const K& k) const {
+        return findIndex(k) != npos;
+    }
+
+    template<typename K>
+    bool tryGetInfo(const K& k, Info& i) const {
+        size_t index = findIndex(k);
+        if (index != npos) {
+            i = infos[index];
+            return true;
+        }
+        return false;
+    }
+
+    template<typename K>
+    const Info& getInfo(const K& k) const {
+        size_t index = findIndex(k);
+        if (index == npos) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return infos[index];
+    }
+
+private:
+    static constexpr size_t npos = (size_t)-1;
+
+    // Builds the layout from n entries; next() yields (key, info) pointers in key order
+    template<typename Next>
+    FrozenDictionary(size_t n, Next next, Compare c) : comp(c) {
+        std::vector<std::pair<const Key*, const Info*>> sorted;
+        sorted.reserve(n);
+        for (size_t r = 0; r < n; ++r) {
+            sorted.push_back(next());
+        }
+        std::vector<size_t> rankOf(n);
+        size_t rank = 0;
+        layout(rankOf, 0, rank);
+        keys.reserve(n + 1);
+        infos.reserve(n);
+        // keys[0] is never searched; it puts one-based slot j at keys[j]
+        if (n > 0) {
+            keys.push_back(*sorted[rankOf[0]].first);
+        }
+        for (size_t slot = 0; slot < n; ++slot) {
+            keys.push_back(*sorted[rankOf[slot]].first);
+            infos.push_back(*sorted[rankOf[slot]].second);
+        }
+    }
+
+    // An in-order walk over the implicit tree gives the rank stored in every slot
+    static void layout(std::vector<size_t>& rankOf, size_t slot, size_t& rank) {
+        if (slot < rankOf.size()) {
+            layout(rankOf, 2 * slot + 1, rank);
+            rankOf[slot] = rank++;
+            layout(rankOf, 2 * slot + 2, rank);
+        }
+    }
+
+    // Without a transparent comparator lookups convert the argument to Key once
+    template<typename K>
+    using LookupKey = typename std::conditional<IsTransparent<Compare>::value, K, Key>::type;
+
+    template<typename K>
+    size_t findIndex(const K& key) const {
+        const LookupKey<K>& k = key;
+        size_t n = infos.size();
+        const Key* base = keys.data();
+        // One-based index j walks the implicit tree, the comparison result picks the child
+        size_t j = 1;
+        while (j <= n) {
+            prefetch(base, j * prefetchStride);
+            j = 2 * j + (size_t)comp(base[j], k);
+        }
+        // Undo the trailing right turns plus the last left one to get the lower bound
+        j >>= ffs(~j);
+        if (j == 0 || comp(k, base[j])) {
+            return npos;
+        }
+        return j - 1;
+    }
+
+    static constexpr size_t cacheLine = 64;
+
+    // Keys in the subtree 4, 3 or 2 levels below slot j start at j * prefetchStride. As many
+    // levels are looked ahead as fit one cache line: 4 for keys up to 4 bytes, 3 for 8-byte
+    // keys. With the aligned array such a block is exactly one line; larger keys get 2 levels.
+    static constexpr size_t prefetchStride =
+        sizeof(Key) <= cacheLine / 16 ? 16 : sizeof(Key) <= cacheLine / 8 ? 8 : 4;
+
+    // Integer arithmetic, since the block may lie past the end of the array
+    static void prefetch(const Key* base, size_t j) {
+#if defined(__GNUC__)
+        __builtin_prefetch((const void*)((uintptr_t)base + j * sizeof(Key)));
+#else
+        (void)base;
+        (void)j;
+#endif
+    }
+
+    // Number of trailing one bits plus one, for an index with at least one zero bit
+    static int ffs(size_t x) {
+#if defined(__GNUC__)
+        return __builtin_ffsll((long long)x);
+#else
+        int bit = 1;
+        while ((x & 1) == 0) {
+            x >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    std::vector<Key, CacheLineAllocator<Key>> keys;
+    std::vector<Info> infos;
+    Compare comp;
+
+    template<typename, typename, typename, typename, size_t>
+    friend class Dictionary;
+};
+
+// Binary encoding of keys and infos in snapshot files. Trivially copyable types
+// are stored as their raw bytes, strings as a 32-bit length and the characters.
+// read() returns a view into the file (string_view for strings) and advances p.
+template<typename T, typename = void>
+struct SnapshotCodec;
+
+template<typename T>
+struct SnapshotCodec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    using View = T;
+
+    static size_t size(const T&) {
+        return sizeof(T);
+    }
+
+    static void write(std::ostream& os, const T& value) {
+        os.write((const char*)&value, sizeof(T));
+    }
+
+    static View read(const char*& p, const char* end) {
+        if ((size_t)(end - p) < sizeof(T)) {
+            throw std::runtime_error("The snapshot file is corrupt");
+        }
+        T value;
+        std::memcpy((void*)&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+};
+
+template<>
+struct SnapshotCodec<std::string> {
+    using View = std::string_view;
+
+    static size_t size(const std::string& value) {
+        return sizeof(uint32_t) + value.size();
+    }
+
+    static void write(std::ostream& os, const std::string& value) {
+        if (value.size() > UINT32_MAX) {
+            throw std::runtime_error("The string is too long for a snapshot");
+        }
+        uint32_t length = (uint32_t)value.size();
+        os.write((const char*)&length, sizeof(length));
+        os.write(value.data(), value.size());
+    }
+
+    static View read(const char*& p, const char* end) {
+        uint32_t length = SnapshotCodec<uint32_t>::read(p, end);
+        if ((size_t)(end - p) < length) {
+            throw std::runtime_error("The snapshot file is corrupt");
+        }
+        View value(p, length);
+        p += length;
+        return value;
+    }
+};
+
+// Snapshot layout: a header, an index with the file offset of every entry, and
+// the entries (key, then info) in ascending key order. Integers are stored in
+// the byte order of the machine which wrote the file; byteOrder detects a mismatch.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint64_t count;
+    uint64_t dataOffset;
+
+    static constexpr uint32_t nativeOrder = 0x01020304;
+    static constexpr uint32_t currentVersion = 1;
+
+    static SnapshotHeader make(uint64_t count) {
+        SnapshotHeader header;
+        std::memcpy(header.magic, "EADSDICT", sizeof(header.magic));
+        header.byteOrder = nativeOrder;
+        header.version = currentVersion;
+        header.count = count;
+        header.dataOffset = sizeof(SnapshotHeader) + count * sizeof(uint64_t);
+        return header;
+    }
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "The snapshot header must not contain padding");
+
+// A read-only view of a whole file: memory-mapped where available, read into memory otherwise
+class MappedFile {
+public:
+    // sequential hints the kernel to read ahead, for files that are read front to back once
+    explicit MappedFile(const std::string& path, bool sequential = false) : begin(nullptr), length(0) {
+#ifdef EADS_HAVE_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot open " + path);
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED) {
+                throw std::runtime_error("Cannot map " + path);
+            }
+            if (sequential) {
+                madvise(mapped, length, MADV_SEQUENTIAL);
+            }
+            begin = (const char*)mapped;
+        }
+        else {
+            close(fd);
+        }
+#else
+        (void)sequential;
+        std::ifstream is(path, std::ios::binary);
+        if (!is) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        begin = buffer.data();
+        length = buffer.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator =(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef EADS_HAVE_MMAP
+        if (begin != nullptr) {
+            munmap((void*)begin, length);
+        }
+#endif
+    }
+
+    const char* data() const {
+        return begin;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const char* begin;
+    size_t length;
+#ifndef EADS_HAVE_MMAP
+    std::vector<char> buffer;
+#endif
+};
+
+// A mapped snapshot file with a validated header
+class SnapshotFile {
+public:
+    explicit SnapshotFile(const std::string& path, bool sequential = false) : file(path, sequential) {
+        if (file.size() < sizeof(SnapshotHeader)) {
+            throw std::runtime_error("The snapshot file is corrupt");
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, "EADSDICT", sizeof(header.magic)) != 0
+            || header.byteOrder != SnapshotHeader::nativeOrder
+            || header.version != SnapshotHeader::currentVersion
+            || header.count > (file.size() - sizeof(SnapshotHeader)) / sizeof(uint64_t)
+            || header.dataOffset != sizeof(SnapshotHeader) + header.count * sizeof(uint64_t)) {
+            throw std::runtime_error("The snapshot file is corrupt or has an unsupported format");
+        }
+    }
+
+    size_t count() const {
+        return (size_t)header.count;
+    }
+
+    // The first entry; entries follow each other in key order
+    const char* entries() const {
+        return file.data() + header.dataOffset;
+    }
+
+    // The index-th entry, in O(1) through the index
+    const char* entry(size_t index) const {
+        uint64_t offset;
+        std::memcpy(&offset, file.data() + sizeof(SnapshotHeader) + index * sizeof(uint64_t), sizeof(offset));
+        if (offset < header.dataOffset || offset >= file.size()) {
+            throw std::runtime_error("The snapshot file is corrupt");
+        }
+        return file.data() + offset;
+    }
+
+    const char* end() const {
+        return file.data() + file.size();
+    }
+
+private:
+    MappedFile file;
+    SnapshotHeader header;
+};
+
+// Serves lookups directly from a snapshot file written by Dictionary::saveSnapshot(),
+// by binary search over its index, without building a tree. Opening is O(1).
+template<typename Key, typename Info, typename Compare = std::less<>>
+class MappedDictionary {
+public:
+    explicit MappedDictionary(const std::string& path) : file(path), comp() {
+
+    }
+
+    int count() const {
+        return (int)file.count();
+    }
+
+    template<typename K>
+    bool hasKey(const K& k) const {
+        return findEntry(k) != nullptr;
+    }
+
+    template<typename K>
+    bool tryGetInfo(const K& k, Info& i) const {
+        const char* p = findEntry(k);
+        if (p != nullptr) {
+            i = Info(SnapshotCodec<Info>::read(p, file.end()));
+            return true;
+        }
+        return false;
+    }
+
+    template<typename K>
+    Info getInfo(const K& k) const {
+        Info i;
+        if (!tryGetInfo(k, i)) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return i;
+    }
+
+private:
+    // Transparent comparators compare keys in place (e.g. as string_view), others need a Key
+    using KeyView = typename std::conditional<IsTransparent<Compare>::value, typename SnapshotCodec<Key>::View, Key>::type;
+
+    template<typename K>
+    using LookupKey = typename std::conditional<IsTransparent<Compare>::value, K, Key>::type;
+
+    // Position of the info of the key, or nullptr
+    template<typename K>
+    const char* findEntry(const K& key) const {
+        const LookupKey<K>& k = key;
+        size_t lo = 0;
+        size_t hi = file.count();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            const char* p = file.entry(mid);
+            KeyView entryKey(SnapshotCodec<Key>::read(p, file.end()));
+            if (comp(entryKey, k)) {
+                lo = mid + 1;
+            }
+            else if (comp(k, entryKey)) {
+                hi = mid;
+            }
+            else {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    SnapshotFile file;
+    Compare comp;
+};
+
+// A balanced search tree, AVL unless another Balance policy is given (see
+// AvlBalance). Lookups take any type comparable with Key when Compare is
+// transparent (the default std::less<>), e.g. string_view for string keys.
+//
+// With N > 0 up to N entries are kept sorted in an array inside the dictionary
+// and searched by a linear scan, without any allocation; the first insert
+// beyond N builds the balanced tree from them. The array is linked as a chain
+// of nodes, so iterators and all read-only operations work on it unchanged, but
+// in this small mode an insert or remove shifts entries between the slots: it
+// invalidates iterators and the references and pointers returned by getInfo,
+// find, getOrInsert and tryEmplace, which may then refer to another entry. Set
+// operations and bulk builds always produce the tree; it turns small again once
+// emptied.
+template<typename Key, typename Info, typename Compare = std::less<>, typename Balance = AvlBalance, size_t N = 0>
+class Dictionary {
+private:
+    struct Node;
+
+public:
+    // Base class for the in-order iterators (end() is represented by a null node)
+    class DictionaryIterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+
+        DictionaryIterator(const DictionaryIterator& copy)
+            : node(copy.node), tree(copy.tree) { }
+
+        DictionaryIterator& operator =(const DictionaryIterator& what) {
+            if (this != &what) {
+                node = what.node;
+                tree = what.tree;
+            }
+            return *this;
+        }
+
+        bool isValid(void) const {
+            return node != nullptr;
+        }
+
+        DictionaryIterator operator ++(int) {
+            DictionaryIterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+
+        // Steps to the in-order successor, O(1) amortized
+        DictionaryIterator& operator ++(void) {
+            if (node != nullptr) {
+                node = successor(node);
+            }
+            return *this;
+        }
+
+        DictionaryIterator operator --(int) {
+            DictionaryIterator prev = *this;
+            --(*this);
+            return prev;
+        }
+
+        // Steps to the in-order predecessor, decrementing end() gives the last entry
+        DictionaryIterator& operator --(void) {
+            if (node != nullptr) {
+                node = predecessor(node);
+            }
+            else if (tree != nullptr && tree->root != nullptr) {
+                node = rightmost(tree->root);
+            }
+            return *this;
+        }
+
+        bool operator ==(const DictionaryIterator& what) const {
+            return node == what.node;
+        }
+
+        bool operator !=(const DictionaryIterator& what) const {
+            return node != what.node;
+        }
+
+    protected:
+        DictionaryIterator(Node* n, const Dictionary* t) : node(n), tree(t) { }
+
+        Node* node;
+        const Dictionary* tree;
+
+        friend class Dictionary;
+    };
+
+    // A read-write iterator subclass
+    class Iterator : public DictionaryIterator {
+    public:
+        using value_type = Info;
+        using pointer = Info*;
+        using reference = Info&;
+
+        Iterator(void) : DictionaryIterator(nullptr, nullptr) { }
+        Iterator(const Iterator& copy)
+            : DictionaryIterator(copy) { }
+
+        const Key& getKey(void) const {
+            return this->node->key;
+        }
+
+        const Info& getInfo(void) const {
+            return this->node->info;
+        }
+
+        Info setInfo(Info value) {
+            std::swap(this->node->info, value);
+            return value;
+        }
+
+        Info& operator *(void) const { return this->node->info; }
+
+        Iterator& operator ++(void) {
+            DictionaryIterator::operator++();
+            return *this;
+        }
+
+        Iterator operator ++(int) {
+            Iterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+
+        Iterator& operator --(void) {
+            DictionaryIterator::operator--();
+            return *this;
+        }
+
+        Iterator operator --(int) {
+            Iterator prev = *this;
+            --(*this);
+            return prev;
+        }
+
+    protected:
+        Iterator(Node* n, const Dictionary* t) : DictionaryIterator(n, t) { }
+        friend class Dictionary;
+    };
+
+    // A read-only iterator subclass
+    class ConstIterator : public DictionaryIterator {
+    public:
+        using value_type = Info;
+        using pointer = const Info*;
+        using reference = const Info&;
+
+        ConstIterator(void) : DictionaryIterator(nullptr, nullptr) { }
+        ConstIterator(const ConstIterator& copy)
+            : DictionaryIterator(copy) { }
+        ConstIterator(const Iterator& copy)
+            : DictionaryIterator(copy) { }
+
+        const Key& getKey(void) const {
+            return this->node->key;
+        }
+
+        const Info& getInfo(void) const {
+            return this->node->info;
+        }
+
+        const Info& operator *(void) const { return this->node->info; }
+
+        ConstIterator& operator ++(void) {
+            DictionaryIterator::operator++();
+            return *this;
+        }
+
+        ConstIterator operator ++(int) {
+            ConstIterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+
+        ConstIterator& operator --(void) {
+            DictionaryIterator::operator--();
+            return *this;
+        }
+
+        ConstIterator operator --(int) {
+            ConstIterator prev = *this;
+            --(*this);
+            return prev;
+        }
+
+    protected:
+        ConstIterator(Node* n, const Dictionary* t) : DictionaryIterator(n, t) { }
+        friend class Dictionary;
+    };
+
+    // A [begin, end) pair of iterators, usable in range-based for loops
+    template<typename Iter>
+    class KeyRange {
+    public:
+        KeyRange(Iter b, Iter e) : first(b), last(e) { }
+
+        Iter begin(void) const { return first; }
+        Iter end(void) const { return last; }
+
+    private:
+        Iter first;
+        Iter last;
+    };
+
+    Dictionary() : root(nullptr), comp(), rotationCount(0) {
+
+    }
+
+    explicit Dictionary(const Compare& c) : root(nullptr), comp(c), rotationCount(0) {
+
+    }
+
+    // Builds a balanced tree from (key, info) pairs sorted by key, in O(n)
+    template<typename Iter>
+    Dictionary(SortedInput, Iter first, Iter last) : root(nullptr), comp(), rotationCount(0) {
+        buildFromSorted(first, last);
+    }
+
+    // Builds a balanced tree from (key, info) pairs in any order, in O(n log n)
+    template<typename Iter>
+    Dictionary(Iter first, Iter last) : root(nullptr), comp(), rotationCount(0) {
+        buildFrom(first, last);
+    }
+
+    // Copies of large trees are split across the shared TaskPool
+    Dictionary(const Dictionary& copy) : Dictionary(copy, poolFor(copy.count())) {
+
+    }
+
+    // Copies the tree node for node, cloning subtrees of parallelGrain nodes or more
+    // on the threads of pool; the copy has exactly the shape of a serial one
+    Dictionary(const Dictionary& copy, TaskPool& pool) : Dictionary(copy, &pool) {
+
+    }
+
+    ~Dictionary() {
+        clear();
+    }
+
+    Dictionary& operator =(const Dictionary& that) {
+        if (this != &that) {
+            clear();
+            comp = that.comp;
+            if (that.isSmall()) {
+                copySmall(that);
+            }
+            else {
+                root = cloneTree(that.root, poolFor(that.count()));
+                counters.allocated(that.count());
+            }
+        }
+        return *this;
+    }
+
+    // Draws the levels with N for missing children, in one breadth-first pass
+    void print(std::ostream& os) {
+        int max = getHeight();
+        std::vector<Node*> row(1, root);
+        std::vector<Node*> next;
+        for (int i = 0; i < max; ++i) {
+            os << std::string((max - i) * 3, ' ');
+            next.clear();
+            for (Node* node : row) {
+                if (node != nullptr) {
+                    os << node->key;
+                    next.push_back(node->nodeL);
+                    next.push_back(node->nodeR);
+                }
+                else {
+                    os << "N";
+                }
+                os << std::string((int)std::ceil(1.5 * (max - i)), ' ');
+            }
+            os << "\n\n";
+            row.swap(next);
+        }
+        os.flush();
+    }
+
+    // Writes the tree breadth-first in one O(n) pass, annotating every node with the
+    // height and balance (left minus right height) of its subtree. Levels below
+    // maxDepth and nodes past maxNodes are left out; nodes with children left out
+    // are marked. Output is gathered in 64 KiB chunks before it reaches os. In the
+    // small mode the entries are marked inline instead, as they have no tree shape.
+    void exportTree(std::ostream& os, const TreeExport& options = TreeExport()) const {
+        struct Entry {
+            const Node* node;
+            int depth;
+            size_t parent;
+        };
+        const size_t none = std::numeric_limits<size_t>::max();
+        std::vector<Entry> queue;
+        if (root != nullptr && options.maxNodes > 0 && options.maxDepth >= 0) {
+            queue.push_back(Entry { root, 0, none });
+        }
+
+        // The inline array of the small mode goes out as the chain it is linked as
+        bool inlined = isSmall();
+
+        std::ostringstream buffer;
+        auto flush = [&]() {
+            std::string chunk = buffer.str();
+            os.write(chunk.data(), (std::streamsize)chunk.size());
+            buffer.str(std::string());
+        };
+        if (options.format == TreeFormat::Dot) {
+            buffer << "digraph Dictionary {\n    node [shape=box];\n";
+        }
+        else if (options.format == TreeFormat::Json) {
+            buffer << "{\"count\": " << count();
+            if (inlined) {
+                buffer << ", \"inline\": true";
+            }
+            else {
+                buffer << ", \"height\": " << getHeight();
+            }
+            buffer << ", \"nodes\": [";
+        }
+
+        for (size_t id = 0; id < queue.size(); ++id) {
+            Entry entry = queue[id];
+            const Node* n = entry.node;
+            size_t children[2] = { none, none };
+            const Node* sides[2] = { n->nodeL, n->nodeR };
+            bool truncated = false;
+            for (int side = 0; side < 2; ++side) {
+                if (sides[side] == nullptr) {
+                    continue;
+                }
+                if (entry.depth < options.maxDepth && queue.size() < options.maxNodes) {
+                    children[side] = queue.size();
+                    queue.push_back(Entry { sides[side], entry.depth + 1, id });
+                }
+                else {
+                    truncated = true;
+                }
+            }
+            int height = getHeight(n);
+            int balance = getHeight(n->nodeL) - getHeight(n->nodeR);
+
+            if (options.format == TreeFormat::Text) {
+                if (id == 0 || queue[id - 1].depth != entry.depth) {
+                    buffer << (id == 0 ? "" : "\n") << entry.depth << ":";
+                }
+                buffer << " " << n->key;
+                if (inlined) {
+                    buffer << " [inline]";
+                }
+                else {
+                    buffer << " [h=" << height << " b=" << balance << "]";
+                }
+                buffer << (truncated ? "..." : "");
+            }
+            else if (options.format == TreeFormat::Dot) {
+                buffer << "    n" << id << " [label=\"";
+                writeEscaped(buffer, n->key, TreeFormat::Dot);
+                if (inlined) {
+                    buffer << "\\ninline";
+                }
+                else {
+                    buffer << "\\nh=" << height << " b=" << balance;
+                }
+                buffer << "\"" << (truncated ? " style=dashed" : "") << "];\n";
+                if (entry.parent != none) {
+                    buffer << "    n" << entry.parent << " -> n" << id
+                           << (queue[entry.parent].node->nodeL == n ? " [label=L];\n" : " [label=R];\n");
+                }
+            }
+            else {
+                buffer << (id == 0 ? "\n" : ",\n") << "  {\"id\": " << id << ", \"key\": ";
+                writeJson(buffer, n->key);
+                if (!inlined) {
+                    buffer << ", \"height\": " << height << ", \"balance\": " << balance;
+                }
+                buffer << ", \"size\": " << sizeOf(n);
+                for (int side = 0; side < 2; ++side) {
+                    buffer << (side == 0 ? ", \"left\": " : ", \"right\": ");
+                    if (children[side] != none) {
+                        buffer << children[side];
+                    }
+                    else {
+                        buffer << "null";
+                    }
+                }
+                buffer << ", \"truncated\": " << (truncated ? "true" : "false") << "}";
+            }
+            if (buffer.tellp() >= 1 << 16) {
+                flush();
+            }
+        }
+
+        if (options.format == TreeFormat::Text) {
+            buffer << (queue.empty() ? "" : "\n");
+            if (queue.size() < (size_t)count()) {
+                buffer << "(" << queue.size() << " of " << count() << " nodes)\n";
+            }
+        }
+        else if (options.format == TreeFormat::Dot) {
+            buffer << "}\n";
+        }
+        else {
+            buffer << (queue.empty() ? "]}\n" : "\n]}\n");
+        }
+        flush();
+    }
+
+    // O(1), every node keeps the size of its subtree
+    int count() const {
+        return sizeOf(root);
+    }
+
+    int height() const {
+        return getHeight(root);
+    }
+
+    // Whether keys are in order, parent links, sizes and heights are right, and the balancing
+    // policy's invariant holds (not checked on the inline chain of the small mode). O(n), for tests.
+    bool isConsistent() const {
+        const Node* previous = nullptr;
+        return isConsistent(root, nullptr, previous) && (isSmall() || Balance::holds(*this, root));
+    }
+
+    // Rotations done by the balancing policy since construction or resetRotations(),
+    // for comparing policies. Approximate after a ParallelJoin set operation.
+    size_t rotations() const {
+        return rotationCount.load(std::memory_order_relaxed);
+    }
+
+    void resetRotations() {
+        rotationCount.store(0, std::memory_order_relaxed);
+    }
+
+    // Operation counts since construction or resetStats(), all zero unless built
+    // with EADS_STATS. Node visits are the steps of searches and merge walks.
+    ContainerStats stats() const {
+        return counters.get();
+    }
+
+    void resetStats() {
+        counters.reset();
+    }
+
+    // Large trees are freed on the shared TaskPool
+    void clear() {
+        clear(poolFor(count()));
+    }
+
+    // Frees subtrees of parallelGrain nodes or more on the threads of pool
+    void clear(TaskPool& pool) {
+        clear(&pool);
+    }
+
+    void insert(const Key& k, const Info& i) {
+        EADS_TIMED("Dictionary::insert");
+        bool inserted;
+        place(k, [&](void* at) { return newNode(at, k, i); }, inserted);
+        if (!inserted) {
+            throw std::runtime_error("Duplicate keys are forbidden");
+        }
+    }
+
+    // Moves the key and info into the new node
+    void insert(Key&& k, Info&& i) {
+        EADS_TIMED("Dictionary::insert");
+        bool inserted;
+        place(k, [&](void* at) { return newNode(at, std::in_place, std::move(k), std::move(i)); }, inserted);
+        if (!inserted) {
+            throw std::runtime_error("Duplicate keys are forbidden");
+        }
+    }
+
+    // Inserts the entry or overwrites the info of an existing key; true if inserted
+    template<typename K, typename I>
+    bool insertOrAssign(K&& k, I&& i) {
+        EADS_TIMED("Dictionary::insertOrAssign");
+        bool inserted;
+        Node* n = place(k, [&](void* at) { return newNode(at, std::in_place, std::forward<K>(k), std::forward<I>(i)); }, inserted);
+        if (!inserted) {
+            n->info = std::forward<I>(i);
+        }
+        return inserted;
+    }
+
+    // Constructs the info from args in place unless the key is already present,
+    // in which case neither the key nor args are touched
+    template<typename K, typename... Args>
+    std::pair<Iterator, bool> tryEmplace(K&& k, Args&&... args) {
+        EADS_TIMED("Dictionary::tryEmplace");
+        bool inserted;
+        Node* n = place(k, [&](void* at) {
+            return newNode(at, std::in_place, std::forward<K>(k), std::forward<Args>(args)...);
+        }, inserted);
+        return std::pair<Iterator, bool>(Iterator(n, this), inserted);
+    }
+
+    // Info of the key, inserting factory() first if the key is missing
+    template<typename K, typename Factory>
+    Info& getOrInsert(K&& k, Factory factory) {
+        EADS_TIMED("Dictionary::getOrInsert");
+        bool inserted;
+        Node* n = place(k, [&](void* at) { return newNode(at, std::in_place, std::forward<K>(k), factory()); }, inserted);
+        return n->info;
+    }
+
+    template<typename K>
+    void remove(const K& k) {
+        EADS_TIMED("Dictionary::remove");
+        const LookupKey<K>& key = k;
+        if (isSmall()) {
+            int order;
+            size_t index = findSmall(key, prefixOf(key), order);
+            if (order == 0) {
+                eraseSmall(index);
+            }
+            return;
+        }
+        typename Balance::RemoveState state;
+        root = Balance::fixRoot(remove(root, key, prefixOf(key), state));
+        if (root != nullptr) {
+            root->parent = nullptr;
+        }
+    }
+
+    template<typename K>
+    bool hasKey(const K& k) const {
+        EADS_TIMED("Dictionary::hasKey");
+        return findNode(k) != nullptr;
+    }
+
+    template<typename K>
+    bool tryGetInfo(const K& k, Info& i) const {
+        EADS_TIMED("Dictionary::tryGetInfo");
+        Node* n = findNode(k);
+        if (n != nullptr) {
+            i = n->info;
+            return true;
+        }
+        return false;
+    }
+    
+    template<typename K>
+    Info& getInfo(const K& k) {
+        EADS_TIMED("Dictionary::getInfo");
+        Node* n = findNode(k);
+        if (n == nullptr) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return n->info;
+    }
+
+    template<typename K>
+    const Info& getInfo(const K& k) const {
+        EADS_TIMED("Dictionary::getInfo");
+        Node* n = findNode(k);
+        if (n == nullptr) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return n->info;
+    }
+
+    // Pointer to the info of the key without copying it, or nullptr
+    template<typename K>
+    Info* find(const K& k) {
+        EADS_TIMED("Dictionary::find");
+        Node* n = findNode(k);
+        return n != nullptr ? &n->info : nullptr;
+    }
+
+    template<typename K>
+    const Info* find(const K& k) const {
+        EADS_TIMED("Dictionary::find");
+        Node* n = findNode(k);
+        return n != nullptr ? &n->info : nullptr;
+    }
+
+    Iterator begin(void) {
+        return Iterator(root != nullptr ? leftmost(root) : nullptr, this);
+    }
+
+    ConstIterator begin(void) const {
+        return ConstIterator(root != nullptr ? leftmost(root) : nullptr, this);
+    }
+
+    Iterator end(void) {
+        return Iterator(nullptr, this);
+    }
+
+    ConstIterator end(void) const {
+        return ConstIterator(nullptr, this);
+    }
+
+    // First entry whose key is not less than k
+    template<typename K>
+    Iterator lowerBound(const K& k) {
+        EADS_TIMED("Dictionary::lowerBound");
+        return Iterator(lowerBoundNode(k), this);
+    }
+
+    template<typename K>
+    ConstIterator lowerBound(const K& k) const {
+        EADS_TIMED("Dictionary::lowerBound");
+        return ConstIterator(lowerBoundNode(k), this);
+    }
+
+    // First entry whose key is greater than k
+    template<typename K>
+    Iterator upperBound(const K& k) {
+        EADS_TIMED("Dictionary::upperBound");
+        return Iterator(upperBoundNode(k), this);
+    }
+
+    template<typename K>
+    ConstIterator upperBound(const K& k) const {
+        EADS_TIMED("Dictionary::upperBound");
+        return ConstIterator(upperBoundNode(k), this);
+    }
+
+    // All entries with lo <= key <= hi, in O(log n + k)
+    template<typename K>
+    KeyRange<Iterator> range(const K& lo, const K& hi) {
+        if (comp(static_cast<const LookupKey<K>&>(hi), static_cast<const LookupKey<K>&>(lo))) {
+            return KeyRange<Iterator>(end(), end());
+        }
+        return KeyRange<Iterator>(lowerBound(lo), upperBound(hi));
+    }
+
+    template<typename K>
+    KeyRange<ConstIterator> range(const K& lo, const K& hi) const {
+        if (comp(static_cast<const LookupKey<K>&>(hi), static_cast<const LookupKey<K>&>(lo))) {
+            return KeyRange<ConstIterator>(end(), end());
+        }
+        return KeyRange<ConstIterator>(lowerBound(lo), upperBound(hi));
+    }
+
+    // Calls fn(key, info) for every entry with lo <= key <= hi, in key order. The key is
+    // passed const, so a callback which would rewrite keys is not accepted
+    template<typename K, typename Fn>
+    typename std::enable_if<std::is_invocable<Fn&, const Key&, Info&>::value>::type
+    forEachInRange(const K& lo, const K& hi, Fn fn) {
+        const LookupKey<K>& last = hi;
+        for (Node* n = lowerBoundNode(lo); n != nullptr && !comp(last, n->key); n = successor(n)) {
+            counters.visited();
+            counters.compared();
+            fn(static_cast<const Key&>(n->key), n->info);
+        }
+    }
+
+    template<typename K, typename Fn>
+    typename std::enable_if<std::is_invocable<Fn&, const Key&, const Info&>::value>::type
+    forEachInRange(const K& lo, const K& hi, Fn fn) const {
+        const LookupKey<K>& last = hi;
+        for (Node* n = lowerBoundNode(lo); n != nullptr && !comp(last, n->key); n = successor(n)) {
+            counters.visited();
+            counters.compared();
+            fn(static_cast<const Key&>(n->key), static_cast<const Info&>(n->info));
+        }
+    }
+
+    // Number of keys less than k, in O(log n)
+    template<typename K>
+    int rank(const K& key) const {
+        EADS_TIMED("Dictionary::rank");
+        const LookupKey<K>& k = key;
+        Prefix prefix = prefixOf(k);
+        int result = 0;
+        for (Node* n = root; n != nullptr; ) {
+            if (compare(k, prefix, n) > 0) {
+                result += sizeOf(n->nodeL) + 1;
+                n = n->nodeR;
+            }
+            else {
+                n = n->nodeL;
+            }
+        }
+        return result;
+    }
+
+    // The entry with the given zero-based rank, or end() if out of range, in O(log n)
+    Iterator select(int index) {
+        EADS_TIMED("Dictionary::select");
+        return Iterator(selectNode(index), this);
+    }
+
+    ConstIterator select(int index) const {
+        EADS_TIMED("Dictionary::select");
+        return ConstIterator(selectNode(index), this);
+    }
+
+    // Number of entries with lo <= key <= hi, in O(log n)
+    template<typename K>
+    int countInRange(const K& lo, const K& hi) const {
+        EADS_TIMED("Dictionary::countInRange");
+        const LookupKey<K>& last = hi;
+        if (comp(last, static_cast<const LookupKey<K>&>(lo))) {
+            return 0;
+        }
+        Prefix prefix = prefixOf(last);
+        int notGreater = 0;
+        for (Node* n = root; n != nullptr; ) {
+            if (compare(last, prefix, n) < 0) {
+                n = n->nodeL;
+            }
+            else {
+                notGreater += sizeOf(n->nodeL) + 1;
+                n = n->nodeR;
+            }
+        }
+        return notGreater - rank(lo);
+    }
+
+    // Adds all entries of other; a key present in both throws before anything changes
+    void merge(const Dictionary& other, SetAlgorithm algorithm = SetAlgorithm::Auto) {
+        unionWith(other, ConflictPolicy::Forbid, algorithm);
+    }
+
+    void unionWith(const Dictionary& other, ConflictPolicy policy = ConflictPolicy::KeepOurs,
+                   SetAlgorithm algorithm = SetAlgorithm::Auto) {
+        if (policy == ConflictPolicy::Forbid && intersects(other)) {
+            throw std::runtime_error("Duplicate keys are forbidden");
+        }
+        bool keepOurs = policy != ConflictPolicy::KeepTheirs;
+        auto resolve = [keepOurs](const Key&, const Info& ours, const Info& theirs) {
+            return keepOurs ? ours : theirs;
+        };
+        unite(other, resolve, choose(algorithm, count(), other.count()));
+    }
+
+    // Adds all entries of other. For keys in both, resolve(key, ours, theirs) returns
+    // the info to keep. On the join paths a throwing resolve loses entries.
+    // With SetAlgorithm::ParallelJoin, resolve is called from several threads at
+    // once and must be safe for that; Auto never picks ParallelJoin here.
+    template<typename Resolve>
+    void unionWith(const Dictionary& other, Resolve resolve, SetAlgorithm algorithm = SetAlgorithm::Auto) {
+        SetAlgorithm chosen = choose(algorithm, count(), other.count());
+        if (algorithm == SetAlgorithm::Auto && chosen == SetAlgorithm::ParallelJoin) {
+            chosen = SetAlgorithm::Linear;
+        }
+        unite(other, resolve, chosen);
+    }
+
+    // Keeps only the keys which other has too, with the infos of this dictionary
+    void intersect(const Dictionary& other, SetAlgorithm algorithm = SetAlgorithm::Auto) {
+        EADS_TIMED("Dictionary::intersect");
+        if (&other == this) {
+            return;
+        }
+        filter(other, SetOp { false, false, true, false }, algorithm);
+    }
+
+    // Removes all keys which other has
+    void difference(const Dictionary& other, SetAlgorithm algorithm = SetAlgorithm::Auto) {
+        EADS_TIMED("Dictionary::difference");
+        if (&other == this) {
+            clear();
+            return;
+        }
+        filter(other, SetOp { true, false, false, false }, algorithm);
+    }
+
+    // Produces an immutable, cache-friendly copy for lookup-heavy use
+    FrozenDictionary<Key, Info, Compare> freeze() const {
+        Node* n = root != nullptr ? leftmost(root) : nullptr;
+        return FrozenDictionary<Key, Info, Compare>((size_t)count(), [&n]() {
+            std::pair<const Key*, const Info*> entry(&n->key, &n->info);
+            n = successor(n);
+            return entry;
+        }, comp);
+    }
+
+    // Writes all entries in key order in the snapshot format (see SnapshotHeader)
+    void saveSnapshot(std::ostream& os) const {
+        SnapshotHeader header = SnapshotHeader::make((uint64_t)count());
+        os.write((const char*)&header, sizeof(header));
+        uint64_t offset = header.dataOffset;
+        for (Node* n = root != nullptr ? leftmost(root) : nullptr; n != nullptr; n = successor(n)) {
+            os.write((const char*)&offset, sizeof(offset));
+            offset += SnapshotCodec<Key>::size(n->key) + SnapshotCodec<Info>::size(n->info);
+        }
+        for (Node* n = root != nullptr ? leftmost(root) : nullptr; n != nullptr; n = successor(n)) {
+            SnapshotCodec<Key>::write(os, n->key);
+            SnapshotCodec<Info>::write(os, n->info);
+        }
+        if (!os) {
+            throw std::runtime_error("Failed to write the snapshot");
+        }
+    }
+
+    void saveSnapshot(const std::string& path) const {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        saveSnapshot(os);
+        os.close();
+        if (!os) {
+            throw std::runtime_error("Failed to write the snapshot to " + path);
+        }
+    }
+
+    // Replaces the contents with a snapshot file. The file is mapped and read
+    // front to back once, building the balanced tree directly, without rotations.
+    void loadSnapshot(const std::string& path) {
+        EADS_TIMED("Dictionary::loadSnapshot");
+        SnapshotFile file(path, true);
+        const char* p = file.entries();
+        const char* end = file.end();
+        Node* prev = nullptr;
+        auto next = [&]() {
+            auto key = SnapshotCodec<Key>::read(p, end);
+            auto info = SnapshotCodec<Info>::read(p, end);
+            Node* node = new Node(std::in_place, Key(key), Info(info));
+            counters.allocated();
+            counters.compared(prev != nullptr ? 1 : 0);
+            if (prev != nullptr && !comp(prev->key, node->key)) {
+                delete node;
+                counters.freed();
+                throw std::runtime_error("The snapshot file is corrupt");
+            }
+            prev = node;
+            return node;
+        };
+        Node* built = buildInOrder(next, file.count());
+        if (p != end) {
+            counters.freed(sizeOf(built));
+            delete built;
+            throw std::runtime_error("The snapshot file is corrupt");
+        }
+        clear();
+        root = built;
+    }
+
+    // Replaces the contents with (key, info) pairs sorted by key.
+    // The tree is built perfectly balanced in O(n), without any rotations.
+    template<typename Range>
+    void buildFromSorted(const Range& range) {
+        buildFromSorted(std::begin(range), std::end(range));
+    }
+
+    template<typename Iter>
+    void buildFromSorted(Iter first, Iter last) {
+        EADS_TIMED("Dictionary::buildFromSorted");
+        size_t n = checkSorted(first, last);
+        Node* built = buildBalanced(first, n);
+        clear();
+        root = built;
+    }
+
+    // Replaces the contents with (key, info) pairs in any order (sorts a copy first)
+    template<typename Range>
+    void buildFrom(const Range& range) {
+        buildFrom(std::begin(range), std::end(range));
+    }
+
+    template<typename Iter>
+    void buildFrom(Iter first, Iter last) {
+        EADS_TIMED("Dictionary::buildFrom");
+        std::vector<std::pair<Key, Info>> entries;
+        for (; first != last; ++first) {
+            entries.emplace_back(first->first, first->second);
+        }
+        std::stable_sort(entries.begin(), entries.end(),
+            [this](const std::pair<Key, Info>& a, const std::pair<Key, Info>& b) {
+                counters.compared();
+                return comp(a.first, b.first);
+            });
+        buildFromSorted(entries.begin(), entries.end());
+    }
+
+private:
+    template<typename K>
+    using LookupKey = typename std::conditional<IsTransparent<Compare>::value, K, Key>::type;
+
+    using Prefix = KeyPrefix<Key, Compare>;
+
+    struct Node {
+        Key key;
+        [[no_unique_address]] Prefix prefix;
+        Info info;
+        Node* nodeL;
+        Node* nodeR;
+        Node* parent;
+        // Number of nodes and height of the subtree rooted here
+        int size;
+        int height;
+        [[no_unique_address]] typename Balance::NodeData data;
+
+        Node(const Key& k, const Info& i, Node* l = nullptr, Node* r = nullptr)
+            : key(k), prefix(Prefix::of(key)), info(i), nodeL(l), nodeR(r), parent(nullptr), size(1), height(1)
+        {
+            if (nodeL != nullptr) nodeL->parent = this;
+            if (nodeR != nullptr) nodeR->parent = this;
+            update(this);
+        }
+
+        template<typename K, typename... Args>
+        Node(std::in_place_t, K&& k, Args&&... args)
+            : key(std::forward<K>(k)), prefix(Prefix::of(key)), info(std::forward<Args>(args)...),
+              nodeL(nullptr), nodeR(nullptr), parent(nullptr), size(1), height(1)
+        {
+        }
+
+        Node(const Node& copy) : Node(copy.key, copy.info) {
+            if (copy.nodeL != nullptr) {
+                nodeL = new Node(*(copy.nodeL));
+                nodeL->parent = this;
+            }
+            if (copy.nodeR != nullptr) {
+                nodeR = new Node(*(copy.nodeR));
+                nodeR->parent = this;
+            }
+            size = copy.size;
+            height = copy.height;
+            data = copy.data;
+        }
+
+        ~Node() {
+            if (nodeL != nullptr) {
+                delete nodeL;
+            }
+            if (nodeR != nullptr) {
+                delete nodeR;
+            }
+        }
+
+        int getType() const {
+            int type = 0;
+            if (nodeL != nullptr) type += 1;
+            if (nodeR != nullptr) type += 2;
+            return type;
+        }
+    };
+
+    // Validates that keys are strictly increasing and returns the length of the range
+    template<typename Iter>
+    size_t checkSorted(Iter first, Iter last) const {
+        size_t n = 0;
+        Iter prev = first;
+        for (Iter it = first; it != last; ++it, ++n) {
+            if (n > 0) {
+                counters.compared(2);
+                if (comp(it->first, prev->first)) {
+                    throw std::runtime_error("Input keys are not sorted");
+                }
+                if (!comp(prev->first, it->first)) {
+                    throw std::runtime_error("Duplicate keys are forbidden");
+                }
+                prev = it;
+            }
+        }
+        return n;
+    }
+
+    // Builds the next n entries of the range in-order, the middle one becomes the root
+    template<typename Iter>
+    Node* buildBalanced(Iter& it, size_t n) {
+        auto next = [this, &it]() {
+            Node* node = new Node(it->first, it->second);
+            counters.allocated();
+            ++it;
+            return node;
+        };
+        return buildInOrder(next, n);
+    }
+
+    // Builds a balanced tree of n nodes; next() allocates the node for the next key in order
+    template<typename Next>
+    Node* buildInOrder(Next& next, size_t n) {
+        return buildInOrder(next, n, 0, n);
+    }
+
+    template<typename Next>
+    Node* buildInOrder(Next& next, size_t n, int depth, size_t total) {
+        if (n == 0) {
+            return nullptr;
+        }
+        size_t half = n / 2;
+        Node* l = buildInOrder(next, half, depth + 1, total);
+        Node* node = nullptr;
+        try {
+            node = next();
+        }
+        catch (...) {
+            counters.freed(sizeOf(l));
+            delete l;
+            throw;
+        }
+        node->nodeL = l;
+        if (l != nullptr) {
+            l->parent = node;
+        }
+        try {
+            node->nodeR = buildInOrder(next, n - half - 1, depth + 1, total);
+            if (node->nodeR != nullptr) {
+                node->nodeR->parent = node;
+            }
+            update(node);
+            Balance::built(node, depth, total);
+        }
+        catch (...) {
+            counters.freed(sizeOf(node));
+            delete node;
+            throw;
+        }
+        return node;
+    }
+
+    // Writes a value with operator<<, escaping quotes and backslashes for DOT and JSON strings
+    template<typename T>
+    static void writeEscaped(std::ostream& os, const T& value, TreeFormat format) {
+        std::ostringstream text;
+        text << value;
+        for (char c : text.str()) {
+            if (c == '"' || c == '\\') {
+                os << '\\';
+            }
+            if ((unsigned char)c >= 0x20) {
+                os << c;
+            }
+            else if (format == TreeFormat::Json) {
+                os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+            }
+            else {
+                // Graphviz knows \n as a line break and no escapes for other control characters
+                os << (c == '\n' ? "\\n" : " ");
+            }
+        }
+    }
+
+    // Numbers as JSON numbers, everything else as JSON strings
+    template<typename T>
+    static void writeJson(std::ostream& os, const T& value) {
+        if constexpr (std::is_arithmetic<T>::value && !std::is_same<T, char>::value && !std::is_same<T, bool>::value) {
+            os << +value;
+        }
+        else {
+            os << '"';
+            writeEscaped(os, value, TreeFormat::Json);
+            os << '"';
+        }
+    }
+
+    template<typename K>
+    static constexpr bool usesPrefix() {
+        return !std::is_empty<Prefix>::value && IsStringKey<K>::value;
+    }
+
+    template<typename K>
+    static Prefix prefixOf(const K& k) {
+        if constexpr (usesPrefix<K>()) {
+            return Prefix::of(k);
+        }
+        else {
+            return Prefix();
+        }
+    }
+
+    // One three-way comparison of k (whose prefix is given) with the key of n;
+    // for string keys the prefixes settle it unless they are equal
+    template<typename K>
+    int compare(const K& k, const Prefix& prefix, const Node* n) const {
+        counters.visited();
+        counters.compared();
+        if constexpr (usesPrefix<K>()) {
+            if (prefix.bytes != n->prefix.bytes) {
+                return prefix.bytes < n->prefix.bytes ? -1 : 1;
+            }
+            return std::string_view(k).compare(std::string_view(n->key));
+        }
+        else {
+            return threeWay(comp, k, n->key);
+        }
+    }
+
+    static int sizeOf(const Node* n) {
+        return n == nullptr ? 0 : n->size;
+    }
+
+    // Recomputes the subtree size and height from the children
+    static void update(Node* n) {
+        n->size = sizeOf(n->nodeL) + sizeOf(n->nodeR) + 1;
+        n->height = std::max(getHeight(n->nodeL), getHeight(n->nodeR)) + 1;
+    }
+
+    int getHeight() const {
+        return getHeight(root);
+    }
+
+    // Checks the subtree of n in order; previous is the node before it
+    bool isConsistent(const Node* n, const Node* parent, const Node*& previous) const {
+        if (n == nullptr) {
+            return true;
+        }
+        if (n->parent != parent || !isConsistent(n->nodeL, n, previous)) {
+            return false;
+        }
+        if (previous != nullptr && !comp(previous->key, n->key)) {
+            return false;
+        }
+        previous = n;
+        return isConsistent(n->nodeR, n, previous) && n->size == sizeOf(n->nodeL) + sizeOf(n->nodeR) + 1
+            && n->height == std::max(getHeight(n->nodeL), getHeight(n->nodeR)) + 1;
+    }
+
+    static int getHeight(const Node* n) {
+        return n == nullptr ? 0 : n->height;
+    }
+
+    // Counts without a locked increment; the parallel set operations may lose a few
+    void countRotation() {
+        rotationCount.store(rotationCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        counters.rotated();
+    }
+
+    Node* rotateL(Node* n) {
+        countRotation();
+        Node* l = n->nodeR;
+        Node* r = l->nodeL;
+        l->nodeL = n;
+        n->nodeR = r;
+        l->parent = n->parent;
+        n->parent = l;
+        if (r != nullptr) {
+            r->parent = n;
+        }
+        update(n);
+        update(l);
+        return l;
+    }
+
+    Node* rotateR(Node* n) {
+        countRotation();
+        Node* r = n->nodeL;
+        Node* l = r->nodeR;
+        r->nodeR = n;
+        n->nodeL = l;
+        r->parent = n->parent;
+        n->parent = r;
+        if (l != nullptr) {
+            l->parent = n;
+        }
+        update(n);
+        update(r);
+        return r;
+    }
+
+    // Descends once; on a miss links in the node returned by create() and rebalances
+    // on the way up, on a hit leaves the tree untouched. placed receives the node
+    // holding the key in both cases.
+    template<typename K, typename Create>
+    Node* place(Node* n, const K& k, const Prefix& prefix, Create& create, Node*& placed, bool& inserted) {
+        if (n == nullptr) {
+            placed = create(nullptr);
+            counters.allocated();
+            inserted = true;
+            return placed;
+        }
+
+        int order = compare(k, prefix, n);
+        if (order < 0) {
+            n->nodeL = place(n->nodeL, k, prefix, create, placed, inserted);
+            n->nodeL->parent = n;
+        }
+        else if (order > 0) {
+            n->nodeR = place(n->nodeR, k, prefix, create, placed, inserted);
+            n->nodeR->parent = n;
+        }
+        else {
+            placed = n;
+            return n;
+        }
+
+        if (!inserted) {
+            return n;
+        }
+        update(n);
+        return Balance::fixInsert(*this, n);
+    }
+
+    template<typename K, typename Create>
+    Node* place(const K& key, Create create, bool& inserted) {
+        const LookupKey<K>& k = key;
+        Node* placed = nullptr;
+        inserted = false;
+        if (isSmall()) {
+            Prefix prefix = prefixOf(k);
+            int order;
+            size_t index = findSmall(k, prefix, order);
+            if (order == 0) {
+                return slots.at(index);
+            }
+            if (slots.size() < N) {
+                inserted = true;
+                return insertSmall(index, create);
+            }
+            spill();
+        }
+        root = Balance::fixRoot(place(root, k, prefixOf(k), create, placed, inserted));
+        root->parent = nullptr;
+        return placed;
+    }
+
+    // Constructs a node in the given inline slot, or on the heap for nullptr
+    template<typename... Args>
+    static Node* newNode(void* at, Args&&... args) {
+        return at != nullptr ? new (at) Node(std::forward<Args>(args)...) : new Node(std::forward<Args>(args)...);
+    }
+
+    // Whether the entries are in the inline array: always while empty, and until it overflows
+    bool isSmall() const {
+        return N > 0 && (root == nullptr || slots.size() > 0);
+    }
+
+    // Index of the first inline entry not less than k; order is the comparison of k with it
+    template<typename K>
+    size_t findSmall(const K& k, const Prefix& prefix, int& order) const {
+        size_t used = slots.size();
+        for (size_t i = 0; i < used; ++i) {
+            order = compare(k, prefix, slots.at(i));
+            if (order <= 0) {
+                return i;
+            }
+        }
+        order = 1;
+        return used;
+    }
+
+    // Links the inline entries into a chain through nodeR, so that iterators and the
+    // tree walks of the read-only operations need no case of their own
+    void linkSmall() {
+        int used = (int)slots.size();
+        for (int i = 0; i < used; ++i) {
+            Node* n = slots.at(i);
+            n->nodeL = nullptr;
+            n->nodeR = i + 1 < used ? slots.at(i + 1) : nullptr;
+            n->parent = i > 0 ? slots.at(i - 1) : nullptr;
+            n->size = n->height = used - i;
+        }
+        root = used > 0 ? slots.at(0) : nullptr;
+    }
+
+    void swapSmall(size_t i, size_t j) {
+        Node* a = slots.at(i);
+        Node* b = slots.at(j);
+        std::swap(a->key, b->key);
+        std::swap(a->prefix, b->prefix);
+        std::swap(a->info, b->info);
+    }
+
+    // Constructs the entry in the next free slot with create() and swaps it down to index
+    template<typename Create>
+    Node* insertSmall(size_t index, Create& create) {
+        size_t used = slots.size();
+        create(slots.slot(used));
+        slots.resize(used + 1);
+        for (size_t i = used; i > index; --i) {
+            swapSmall(i, i - 1);
+        }
+        linkSmall();
+        return slots.at(index);
+    }
+
+    // Swaps the entry at index up to the last slot and destroys it there
+    void eraseSmall(size_t index) {
+        size_t used = slots.size();
+        for (size_t i = index; i + 1 < used; ++i) {
+            swapSmall(i, i + 1);
+        }
+        Node* last = slots.at(used - 1);
+        last->nodeL = last->nodeR = nullptr;
+        last->~Node();
+        slots.resize(used - 1);
+        linkSmall();
+    }
+
+    void clearSmall() {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            Node* n = slots.at(i);
+            n->nodeL = n->nodeR = nullptr;
+            n->~Node();
+        }
+        slots.resize(0);
+        root = nullptr;
+    }
+
+    // Copies the inline entries of from into the empty inline array
+    void copySmall(const Dictionary& from) {
+        try {
+            for (size_t i = 0; i < from.slots.size(); ++i) {
+                const Node* n = from.slots.at(i);
+                new (slots.slot(i)) Node(std::in_place, n->key, n->info);
+                slots.resize(i + 1);
+            }
+        }
+        catch (...) {
+            clearSmall();
+            throw;
+        }
+        linkSmall();
+    }
+
+    // A balanced tree of heap copies of the inline entries of from
+    Node* treeOfSmall(const Dictionary& from) {
+        size_t i = 0;
+        auto next = [this, &from, &i]() {
+            const Node* n = from.slots.at(i++);
+            Node* node = new Node(std::in_place, n->key, n->info);
+            counters.allocated();
+            return node;
+        };
+        return buildInOrder(next, from.slots.size());
+    }
+
+    // Moves the entries to the tree, which is used from now on. The heap memory is taken
+    // first, so no entry leaves its slot unless the whole tree can be built; entries whose
+    // move could throw are copied instead, when they can be
+    void spill() {
+        constexpr bool copies = std::is_copy_constructible<Key>::value && std::is_copy_constructible<Info>::value;
+        constexpr bool safeMoves = std::is_nothrow_move_constructible<Key>::value && std::is_nothrow_move_constructible<Info>::value;
+        Node* built = nullptr;
+        if constexpr (copies && !safeMoves) {
+            built = treeOfSmall(*this);
+        }
+        else {
+            size_t used = slots.size();
+            void* memory[N > 0 ? N : 1];
+            size_t taken = 0;
+            try {
+                for (; taken < used; ++taken) {
+                    memory[taken] = ::operator new(sizeof(Node));
+                }
+            }
+            catch (...) {
+                while (taken > 0) {
+                    ::operator delete(memory[--taken]);
+                }
+                throw;
+            }
+            size_t i = 0;
+            auto next = [this, &memory, &i]() {
+                Node* n = slots.at(i);
+                Node* node = new (memory[i++]) Node(std::in_place, std::move(n->key), std::move(n->info));
+                counters.allocated();
+                return node;
+            };
+            try {
+                built = buildInOrder(next, used);
+            }
+            catch (...) {
+                // Only a move-only entry which threw gets here; its memory and the unused rest go back
+                for (size_t j = i - 1; j < used; ++j) {
+                    ::operator delete(memory[j]);
+                }
+                throw;
+            }
+        }
+        clearSmall();
+        root = built;
+    }
+
+    template<typename Resolve>
+    void unite(const Dictionary& other, Resolve& resolve, SetAlgorithm chosen) {
+        EADS_TIMED("Dictionary::unionWith");
+        if (&other == this) {
+            return;
+        }
+        if (isSmall()) {
+            spill();
+        }
+        if (chosen == SetAlgorithm::Linear) {
+            linearSetOp(other, SetOp { true, true, true, true }, resolve);
+        }
+        else {
+            root = unionTrees(copyOf(other), root, resolve, chosen == SetAlgorithm::ParallelJoin);
+        }
+        root = Balance::fixRoot(root);
+        if (root != nullptr) {
+            root->parent = nullptr;
+        }
+    }
+
+    // Which keys a linear set operation keeps
+    struct SetOp {
+        bool keepOurs;   // keys only in this dictionary
+        bool addTheirs;  // keys only in the other one
+        bool keepBoth;   // keys in both
+        bool resolve;    // whether the resolver picks the info of keys in both
+    };
+
+    // Below this many nodes in total the set operations, copies and teardowns stay on
+    // the calling thread; subtrees smaller than parallelGrain are never split further
+    static constexpr int parallelMinimum = 1 << 18;
+    static constexpr int parallelGrain = 1 << 14;
+
+    static TaskPool* poolFor(int nodes) {
+        return nodes >= parallelMinimum && std::thread::hardware_concurrency() > 1 ? &TaskPool::shared() : nullptr;
+    }
+
+    Dictionary(const Dictionary& copy, TaskPool* pool) : root(nullptr), comp(copy.comp), rotationCount(0) {
+        if (copy.isSmall()) {
+            copySmall(copy);
+            return;
+        }
+        root = cloneTree(copy.root, pool);
+        counters.allocated(copy.count());
+    }
+
+    void clear(TaskPool* pool) {
+        EADS_TIMED("Dictionary::clear");
+        if (isSmall()) {
+            clearSmall();
+        }
+        else if (root != nullptr) {
+            counters.freed(count());
+            destroyTree(root, pool);
+            root = nullptr;
+        }
+    }
+
+    // Copies the tree of n; with a pool, the two subtrees of every node with at least
+    // parallelGrain nodes are copied in parallel
+    static Node* cloneTree(const Node* n, TaskPool* pool) {
+        if (n == nullptr) {
+            return nullptr;
+        }
+        if (pool == nullptr || n->size < parallelGrain) {
+            return new Node(*n);
+        }
+        Node* copy = new Node(std::in_place, n->key, n->info);
+        Node* l = nullptr;
+        Node* r = nullptr;
+        try {
+            pool->forkJoin(
+                [&]() { l = cloneTree(n->nodeL, pool); },
+                [&]() { r = cloneTree(n->nodeR, pool); });
+        }
+        catch (...) {
+            delete l;
+            delete r;
+            delete copy;
+            throw;
+        }
+        link(copy, l, r);
+        copy->data = n->data;
+        return copy;
+    }
+
+    // Deletes the tree of n, in parallel like cloneTree()
+    static void destroyTree(Node* n, TaskPool* pool) {
+        if (pool == nullptr || n->size < parallelGrain) {
+            delete n;
+            return;
+        }
+        Node* l = n->nodeL;
+        Node* r = n->nodeR;
+        n->nodeL = n->nodeR = nullptr;
+        delete n;
+        pool->forkJoin(
+            [&]() { if (l != nullptr) destroyTree(l, pool); },
+            [&]() { if (r != nullptr) destroyTree(r, pool); });
+    }
+
+    static int log2Floor(size_t x) {
+        int result = 0;
+        while (x > 1) {
+            x >>= 1;
+            ++result;
+        }
+        return result;
+    }
+
+    // Whether m lookups in a tree of n keys beat an O(n + m) merge walk
+    static bool lookupIsCheaper(size_t m, size_t n) {
+        return m * (size_t)(log2Floor(n + 1) + 1) * 2 < m + n;
+    }
+
+    static SetAlgorithm choose(SetAlgorithm algorithm, size_t ours, size_t theirs) {
+        if (algorithm != SetAlgorithm::Auto) {
+            return algorithm;
+        }
+        // Splitting our tree by the keys of a much smaller other costs O(m log(n / m + 1))
+        if (theirs > 0 && theirs * (size_t)(log2Floor(ours / theirs + 1) + 1) * 4 < ours + theirs) {
+            return SetAlgorithm::Join;
+        }
+        if (ours + theirs >= (size_t)parallelMinimum && std::thread::hardware_concurrency() > 1) {
+            return SetAlgorithm::ParallelJoin;
+        }
+        return SetAlgorithm::Linear;
+    }
+
+    void filter(const Dictionary& other, SetOp op, SetAlgorithm algorithm) {
+        if (isSmall()) {
+            spill();
+        }
+        SetAlgorithm chosen = choose(algorithm, count(), other.count());
+        if (chosen == SetAlgorithm::Linear && lookupIsCheaper(count(), other.count())) {
+            filterByLookup(other, op.keepBoth);
+        }
+        else if (chosen == SetAlgorithm::Linear) {
+            auto unused = [](const Key&, const Info& ours, const Info&) { return ours; };
+            linearSetOp(other, op, unused);
+        }
+        else if (op.keepBoth) {
+            root = intersectTrees(copyOf(other), root, chosen == SetAlgorithm::ParallelJoin);
+        }
+        else {
+            root = differenceTrees(root, copyOf(other), chosen == SetAlgorithm::ParallelJoin);
+        }
+        root = Balance::fixRoot(root);
+        if (root != nullptr) {
+            root->parent = nullptr;
+        }
+    }
+
+    bool intersects(const Dictionary& other) const {
+        if (lookupIsCheaper(other.count(), count())) {
+            for (Node* t = other.root != nullptr ? leftmost(other.root) : nullptr; t != nullptr; t = successor(t)) {
+                if (findNode(t->key) != nullptr) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        Node* n = root != nullptr ? leftmost(root) : nullptr;
+        Node* t = other.root != nullptr ? leftmost(other.root) : nullptr;
+        while (n != nullptr && t != nullptr) {
+            int order = compare(n->key, n->prefix, t);
+            if (order < 0) {
+                n = successor(n);
+            }
+            else if (order > 0) {
+                t = successor(t);
+            }
+            else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Node* copyOf(const Dictionary& other) {
+        if (other.isSmall()) {
+            return treeOfSmall(other);
+        }
+        Node* copy = cloneTree(other.root, poolFor(other.count()));
+        counters.allocated(other.count());
+        return copy;
+    }
+
+    // Unlinks all nodes into a vector in key order, leaving the dictionary empty
+    std::vector<Node*> detachAll() {
+        std::vector<Node*> nodes;
+        nodes.reserve(count());
+        for (Node* n = root != nullptr ? leftmost(root) : nullptr; n != nullptr; n = successor(n)) {
+            nodes.push_back(n);
+        }
+        for (Node* n : nodes) {
+            n->nodeL = n->nodeR = n->parent = nullptr;
+        }
+        root = nullptr;
+        return nodes;
+    }
+
+    // Links unlinked nodes in key order into a balanced tree, replacing the contents
+    void attachAll(const std::vector<Node*>& nodes) {
+        size_t i = 0;
+        auto next = [&]() {
+            return nodes[i++];
+        };
+        root = buildInOrder(next, nodes.size());
+    }
+
+    // Merge walk over both trees in key order, O(n + m). The nodes of this dictionary
+    // are reused; if copying an entry of other throws, the dictionary is unchanged.
+    template<typename Resolve>
+    void linearSetOp(const Dictionary& other, SetOp op, Resolve& resolve) {
+        std::vector<Node*> ours = detachAll();
+        std::vector<Node*> result;
+        std::vector<Node*> dropped;
+        std::vector<std::pair<Node*, Node*>> both;
+        std::vector<Node*> added;
+        try {
+            size_t i = 0;
+            Node* t = other.root != nullptr ? leftmost(other.root) : nullptr;
+            while (i < ours.size() || t != nullptr) {
+                int order = t == nullptr ? -1 : i == ours.size() ? 1 : compare(ours[i]->key, ours[i]->prefix, t);
+                if (order < 0) {
+                    (op.keepOurs ? result : dropped).push_back(ours[i++]);
+                }
+                else if (order > 0) {
+                    if (op.addTheirs) {
+                        added.push_back(nullptr);
+                        added.back() = new Node(t->key, t->info);
+                        counters.allocated();
+                        result.push_back(added.back());
+                    }
+                    t = successor(t);
+                }
+                else {
+                    if (op.keepBoth) {
+                        result.push_back(ours[i]);
+                        if (op.resolve) {
+                            both.emplace_back(ours[i], t);
+                        }
+                    }
+                    else {
+                        dropped.push_back(ours[i]);
+                    }
+                    ++i;
+                    t = successor(t);
+                }
+            }
+        }
+        catch (...) {
+            for (Node* n : added) {
+                delete n;
+            }
+            counters.freed(added.size());
+            attachAll(ours);
+            throw;
+        }
+        for (Node* n : dropped) {
+            delete n;
+        }
+        counters.freed(dropped.size());
+        attachAll(result);
+        for (std::pair<Node*, Node*>& entry : both) {
+            entry.first->info = resolve(entry.first->key, static_cast<const Info&>(entry.first->info),
+                static_cast<const Info&>(entry.second->info));
+        }
+    }
+
+    // For a dictionary much smaller than other: O(n log m) lookups instead of a merge walk
+    void filterByLookup(const Dictionary& other, bool keepPresent) {
+        std::vector<Node*> nodes = detachAll();
+        std::vector<Node*> kept;
+        kept.reserve(nodes.size());
+        for (Node* n : nodes) {
+            if ((other.findNode(n->key) != nullptr) == keepPresent) {
+                kept.push_back(n);
+            }
+            else {
+                delete n;
+                counters.freed();
+            }
+        }
+        attachAll(kept);
+    }
+
+    // Makes k the root of l and r, updating the subtree data
+    static void link(Node* k, Node* l, Node* r) {
+        k->nodeL = l;
+        k->nodeR = r;
+        k->parent = nullptr;
+        if (l != nullptr) l->parent = k;
+        if (r != nullptr) r->parent = k;
+        update(k);
+    }
+
+    // Unlinks a single node from its children and deletes it
+    void deleteNode(Node* n) {
+        n->nodeL = n->nodeR = nullptr;
+        delete n;
+        counters.freed();
+    }
+
+    // Joins trees l < k < r into one balanced tree
+    Node* join(Node* l, Node* k, Node* r) {
+        return Balance::join(*this, l, k, r);
+    }
+
+    // Joins trees l < r
+    Node* join(Node* l, Node* r) {
+        if (l == nullptr) {
+            return r;
+        }
+        if (r == nullptr) {
+            return l;
+        }
+        Node* rest = nullptr;
+        Node* last = splitLast(l, rest);
+        return join(rest, last, r);
+    }
+
+    // Detaches the largest node of t; rest receives the remaining tree
+    Node* splitLast(Node* t, Node*& rest) {
+        if (t->nodeR == nullptr) {
+            rest = t->nodeL;
+            if (rest != nullptr) {
+                rest->parent = nullptr;
+            }
+            t->nodeL = nullptr;
+            return t;
+        }
+        Node* r = nullptr;
+        Node* last = splitLast(t->nodeR, r);
+        rest = join(t->nodeL, t, r);
+        return last;
+    }
+
+    // Splits t into the keys less than k, the node with key k (or nullptr) and the greater keys
+    void split(Node* t, const Key& k, const Prefix& prefix, Node*& l, Node*& found, Node*& r) {
+        if (t == nullptr) {
+            l = found = r = nullptr;
+            return;
+        }
+        Node* tl = t->nodeL;
+        Node* tr = t->nodeR;
+        int order = compare(k, prefix, t);
+        if (order < 0) {
+            Node* middle = nullptr;
+            split(tl, k, prefix, l, found, middle);
+            r = join(middle, t, tr);
+        }
+        else if (order > 0) {
+            Node* middle = nullptr;
+            split(tr, k, prefix, middle, found, r);
+            l = join(tl, t, middle);
+        }
+        else {
+            l = tl;
+            r = tr;
+            found = t;
+            t->nodeL = t->nodeR = nullptr;
+        }
+        if (l != nullptr) l->parent = nullptr;
+        if (r != nullptr) r->parent = nullptr;
+    }
+
+    // Runs both halves of a divide-and-conquer step, in parallel on the shared TaskPool if fork is set
+    template<typename Left, typename Right>
+    static void forkJoin(bool fork, Left left, Right right) {
+        if (fork) {
+            TaskPool::shared().forkJoin(left, right);
+            return;
+        }
+        left();
+        right();
+    }
+
+    // Union of a tree of the other dictionary's keys and a tree of ours
+    template<typename Resolve>
+    Node* unionTrees(Node* theirs, Node* ours, Resolve& resolve, bool parallel) {
+        if (theirs == nullptr) {
+            return ours;
+        }
+        if (ours == nullptr) {
+            return theirs;
+        }
+        bool fork = parallel && sizeOf(theirs) + sizeOf(ours) >= parallelGrain;
+        Node* ol = nullptr;
+        Node* found = nullptr;
+        Node* orr = nullptr;
+        split(ours, theirs->key, theirs->prefix, ol, found, orr);
+        if (found != nullptr) {
+            theirs->info = resolve(theirs->key, static_cast<const Info&>(found->info),
+                static_cast<const Info&>(theirs->info));
+            deleteNode(found);
+        }
+        Node* tl = theirs->nodeL;
+        Node* tr = theirs->nodeR;
+        Node* l = nullptr;
+        Node* r = nullptr;
+        forkJoin(fork,
+            [&]() { l = unionTrees(tl, ol, resolve, parallel); },
+            [&]() { r = unionTrees(tr, orr, resolve, parallel); });
+        return join(l, theirs, r);
+    }
+
+    // Keys of ours which theirs has too
+    Node* intersectTrees(Node* theirs, Node* ours, bool parallel) {
+        if (theirs == nullptr || ours == nullptr) {
+            counters.freed(sizeOf(theirs) + sizeOf(ours));
+            delete theirs;
+            delete ours;
+            return nullptr;
+        }
+        bool fork = parallel && sizeOf(theirs) + sizeOf(ours) >= parallelGrain;
+        Node* ol = nullptr;
+        Node* found = nullptr;
+        Node* orr = nullptr;
+        split(ours, theirs->key, theirs->prefix, ol, found, orr);
+        Node* tl = theirs->nodeL;
+        Node* tr = theirs->nodeR;
+        deleteNode(theirs);
+        Node* l = nullptr;
+        Node* r = nullptr;
+        forkJoin(fork,
+            [&]() { l = intersectTrees(tl, ol, parallel); },
+            [&]() { r = intersectTrees(tr, orr, parallel); });
+        return found != nullptr ? join(l, found, r) : join(l, r);
+    }
+
+    // Keys of ours which theirs does not have
+    Node* differenceTrees(Node* ours, Node* theirs, bool parallel) {
+        if (ours == nullptr || theirs == nullptr) {
+            counters.freed(sizeOf(theirs));
+            delete theirs;
+            return ours;
+        }
+        bool fork = parallel && sizeOf(theirs) + sizeOf(ours) >= parallelGrain;
+        Node* ol = nullptr;
+        Node* found = nullptr;
+        Node* orr = nullptr;
+        split(ours, theirs->key, theirs->prefix, ol, found, orr);
+        if (found != nullptr) {
+            deleteNode(found);
+        }
+        Node* tl = theirs->nodeL;
+        Node* tr = theirs->nodeR;
+        deleteNode(theirs);
+        Node* l = nullptr;
+        Node* r = nullptr;
+        forkJoin(fork,
+            [&]() { l = differenceTrees(ol, tl, parallel); },
+            [&]() { r = differenceTrees(orr, tr, parallel); });
+        return join(l, r);
+    }
+
+    template<typename K>
+    Node* remove(Node* n, const K& k, const Prefix& prefix, typename Balance::RemoveState& state) {
+        if (n == nullptr) {
+            return n;
+        }
+
+        bool left = false;
+        int order = compare(k, prefix, n);
+        if (order < 0) {
+            n->nodeL = remove(n->nodeL, k, prefix, state);
+            if (n->nodeL != nullptr) {
+                n->nodeL->parent = n;
+            }
+            left = true;
+        }
+        else if (order > 0) {
+            n->nodeR = remove(n->nodeR, k, prefix, state);
+            if (n->nodeR != nullptr) {
+                n->nodeR->parent = n;
+            }
+        }
+        else {
+            Node* temp = nullptr;
+            switch (n->getType()) {
+                case 3:
+                    temp = n->nodeR;
+                    while (temp->nodeL != nullptr) {
+                        temp = temp->nodeL;
+                    }
+                    n->key = temp->key;
+                    n->prefix = temp->prefix;
+                    n->info = temp->info;
+                    n->nodeR = remove(n->nodeR, temp->key, temp->prefix, state);
+                    if (n->nodeR != nullptr) {
+                        n->nodeR->parent = n;
+                    }
+                    temp = nullptr;
+                    break;
+                case 2:
+                    temp = n->nodeR;
+                    break;
+                case 1:
+                    temp = n->nodeL;
+                    break;
+                case 0:
+                    Balance::removed(n, state);
+                    delete n;
+                    counters.freed();
+                    n = nullptr;
+                    break;
+            }
+            if (temp != nullptr) {
+                n->key = temp->key;
+                n->prefix = temp->prefix;
+                n->info = temp->info;
+                n->nodeL = temp->nodeL;
+                n->nodeR = temp->nodeR;
+                if (n->nodeL != nullptr) n->nodeL->parent = n;
+                if (n->nodeR != nullptr) n->nodeR->parent = n;
+                temp->nodeL = nullptr;
+                temp->nodeR = nullptr;
+                delete temp;
+                counters.freed();
+            }
+        }
+
+        if (n == nullptr) {
+            return n;
+        }
+
+        update(n);
+        return Balance::fixRemove(*this, n, left, state);
+    }
+
+    template<typename K>
+    Node* findNode(const K& k) const {
+        const LookupKey<K>& key = k;
+        Prefix prefix = prefixOf(key);
+        if (isSmall()) {
+            int order;
+            size_t index = findSmall(key, prefix, order);
+            return order == 0 ? const_cast<Node*>(slots.at(index)) : nullptr;
+        }
+        Node* n = root;
+        while (n != nullptr) {
+            int order = compare(key, prefix, n);
+            if (order == 0) {
+                break;
+            }
+            n = order < 0 ? n->nodeL : n->nodeR;
+        }
+        return n;
+    }
+
+    template<typename K>
+    Node* lowerBoundNode(const K& key) const {
+        const LookupKey<K>& k = key;
+        Prefix prefix = prefixOf(k);
+        Node* result = nullptr;
+        Node* n = root;
+        while (n != nullptr) {
+            if (compare(k, prefix, n) > 0) {
+                n = n->nodeR;
+            }
+            else {
+                result = n;
+                n = n->nodeL;
+            }
+        }
+        return result;
+    }
+
+    template<typename K>
+    Node* upperBoundNode(const K& key) const {
+        const LookupKey<K>& k = key;
+        Prefix prefix = prefixOf(k);
+        Node* result = nullptr;
+        Node* n = root;
+        while (n != nullptr) {
+            if (compare(k, prefix, n) < 0) {
+                result = n;
+                n = n->nodeL;
+            }
+            else {
+                n = n->nodeR;
+            }
+        }
+        return result;
+    }
+
+    Node* selectNode(int index) const {
+        if (index < 0 || index >= sizeOf(root)) {
+            return nullptr;
+        }
+        Node* n = root;
+        while (true) {
+            counters.visited();
+            int left = sizeOf(n->nodeL);
+            if (index < left) {
+                n = n->nodeL;
+            }
+            else if (index > left) {
+                index -= left + 1;
+                n = n->nodeR;
+            }
+            else {
+                return n;
+            }
+        }
+    }
+
+    static Node* leftmost(Node* n) {
+        while (n->nodeL != nullptr) {
+            n = n->nodeL;
+        }
+        return n;
+    }
+
+    static Node* rightmost(Node* n) {
+        while (n->nodeR != nullptr) {
+            n = n->nodeR;
+        }
+        return n;
+    }
+
+    static Node* successor(Node* n) {
+        if (n->nodeR != nullptr) {
+            return leftmost(n->nodeR);
+        }
+        Node* p = n->parent;
+        while (p != nullptr && n == p->nodeR) {
+            n = p;
+            p = p->parent;
+        }
+        return p;
+    }
+
+    static Node* predecessor(Node* n) {
+        if (n->nodeL != nullptr) {
+            return rightmost(n->nodeL);
+        }
+        Node* p = n->parent;
+        while (p != nullptr && n == p->nodeL) {
+            n = p;
+            p = p->parent;
+        }
+        return p;
+    }
+
+    Node* root;
+    Compare comp;
+    std::atomic<size_t> rotationCount;
+    [[no_unique_address]] StatsCounters counters;
+    [[no_unique_address]] InlineStorage<Node, N> slots;
+
+    friend Balance;
+};
+
+}
+
+#endif
@@ -0,0 +1,461 @@
+#ifndef EADS_HASH_DICTIONARY_H
+#define EADS_HASH_DICTIONARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define EADS_HAVE_SSE2 1
+#endif
+#include "KeyTraits.h"
+#include "Latency.h"
+#include "Stats.h"
+
+namespace eads {
+
+// 16 control bytes of a HashDictionary probed at once. A control byte is
+// empty, deleted, or 7 bits of the hash of a full slot. Masks have bit i set
+// for byte i; SSE2 compares all 16 bytes in one instruction where available.
+class HashGroup {
+public:
+    static constexpr size_t width = 16;
+    static constexpr int8_t empty = -128;
+    static constexpr int8_t deleted = -2;
+
+    explicit HashGroup(const int8_t* ctrl) {
+#ifdef EADS_HAVE_SSE2
+        bytes = _mm_loadu_si128((const __m128i*)ctrl);
+#else
+        std::memcpy(bytes, ctrl, width);
+#endif
+    }
+
+    uint32_t match(int8_t h2) const {
+#ifdef EADS_HAVE_SSE2
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), bytes));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < width; ++i) {
+            mask |= (uint32_t)(bytes[i] == h2) << i;
+        }
+        return mask;
+#endif
+    }
+
+    uint32_t matchEmpty() const {
+        return match(empty);
+    }
+
+    // Empty and deleted are the only negative control bytes
+    uint32_t matchFree() const {
+#ifdef EADS_HAVE_SSE2
+        return (uint32_t)_mm_movemask_epi8(bytes);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < width; ++i) {
+            mask |= (uint32_t)(bytes[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Index of the lowest set bit of a non-zero mask
+    static int lowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        int bit = 0;
+        while ((mask & 1) == 0) {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+private:
+#ifdef EADS_HAVE_SSE2
+    __m128i bytes;
+#else
+    int8_t bytes[width];
+#endif
+};
+
+// An unordered dictionary with open addressing, for keys which never need to be
+// visited in order. Slots are probed a HashGroup at a time (SwissTable layout);
+// every slot keeps the full hash, so a lookup compares keys only when the hashes
+// match and growing never rehashes the keys. Growing is incremental: the old
+// table is moved into the new one a few slots per insert or remove, and lookups
+// check both meanwhile, so no single insert pays for moving the whole table.
+template<typename Key, typename Info, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<>>
+class HashDictionary {
+public:
+    HashDictionary() : migrated(0), hasher(), equal() {
+
+    }
+
+    HashDictionary(const HashDictionary& copy) : migrated(0), hasher(copy.hasher), equal(copy.equal) {
+        copyFrom(copy);
+    }
+
+    ~HashDictionary() {
+        clear();
+    }
+
+    HashDictionary& operator =(const HashDictionary& that) {
+        if (this != &that) {
+            clear();
+            hasher = that.hasher;
+            equal = that.equal;
+            copyFrom(that);
+        }
+        return *this;
+    }
+
+    int count() const {
+        return (int)(current.used + old.used);
+    }
+
+    // Operation counts since construction or resetStats(), all zero unless built with
+    // EADS_STATS. Visits are the slots probed, allocations and frees count tables.
+    ContainerStats stats() const {
+        return counters.get();
+    }
+
+    void resetStats() {
+        counters.reset();
+    }
+
+    void clear() {
+        EADS_TIMED("HashDictionary::clear");
+        release(current);
+        release(old);
+        migrated = 0;
+    }
+
+    void insert(const Key& k, const Info& i) {
+        EADS_TIMED("HashDictionary::insert");
+        if (!place(k, k, i)) {
+            throw std::runtime_error("Duplicate keys are forbidden");
+        }
+    }
+
+    // Moves the key and info into the new slot
+    void insert(Key&& k, Info&& i) {
+        EADS_TIMED("HashDictionary::insert");
+        if (!place(k, std::move(k), std::move(i))) {
+            throw std::runtime_error("Duplicate keys are forbidden");
+        }
+    }
+
+    template<typename K>
+    void remove(const K& k) {
+        EADS_TIMED("HashDictionary::remove");
+        const LookupKey<K>& key = k;
+        size_t h = hashOf(key);
+        size_t index = findSlot(current, key, h);
+        if (index != npos) {
+            erase(current, index);
+        }
+        else if (old.capacity != 0) {
+            index = findSlot(old, key, h);
+            if (index != npos) {
+                erase(old, index);
+            }
+        }
+        migrate(migrationStep);
+    }
+
+    template<typename K>
+    bool hasKey(const K& k) const {
+        EADS_TIMED("HashDictionary::hasKey");
+        return find(k) != nullptr;
+    }
+
+    template<typename K>
+    bool tryGetInfo(const K& k, Info& i) const {
+        EADS_TIMED("HashDictionary::tryGetInfo");
+        const Slot* slot = find(k);
+        if (slot == nullptr) {
+            return false;
+        }
+        i = slot->info;
+        return true;
+    }
+
+    template<typename K>
+    Info& getInfo(const K& k) {
+        return const_cast<Info&>(static_cast<const HashDictionary*>(this)->getInfo(k));
+    }
+
+    template<typename K>
+    const Info& getInfo(const K& k) const {
+        EADS_TIMED("HashDictionary::getInfo");
+        const Slot* slot = find(k);
+        if (slot == nullptr) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return slot->info;
+    }
+
+private:
+    // Lookups take any type hashable and comparable with Key when both functors are transparent
+    template<typename K>
+    using LookupKey = typename std::conditional<IsTransparent<Hash>::value && IsTransparent<KeyEqual>::value,
+        K, Key>::type;
+
+    struct Slot {
+        size_t hash;
+        Key key;
+        Info info;
+
+        template<typename K, typename I>
+        Slot(size_t h, K&& k, I&& i) : hash(h), key(std::forward<K>(k)), info(std::forward<I>(i)) { }
+    };
+
+    struct Table {
+        int8_t* ctrl = nullptr;
+        Slot* slots = nullptr;
+        size_t capacity = 0;    // 0 or a power of two, at least HashGroup::width
+        size_t used = 0;
+        size_t growthLeft = 0;  // empty slots which may still be filled, keeping 1/8 of the table empty
+    };
+
+    static constexpr size_t npos = (size_t)-1;
+    // Old slots moved per insert or remove; moving finishes long before the new table fills up
+    static constexpr size_t migrationStep = 32;
+
+    template<typename K>
+    size_t hashOf(const K& k) const {
+        return mix(hasher(k));
+    }
+
+    // Spreads identity hashes (e.g. of integers) over all bits
+    static size_t mix(size_t h) {
+        uint64_t x = (uint64_t)h * 0x9E3779B97F4A7C15ull;
+        return (size_t)(x ^ (x >> 32));
+    }
+
+    static int8_t h2(size_t h) {
+        return (int8_t)(h & 0x7F);
+    }
+
+    Table allocate(size_t capacity) {
+        Table t;
+        t.slots = static_cast<Slot*>(::operator new(capacity * sizeof(Slot)));
+        try {
+            t.ctrl = new int8_t[capacity];
+        }
+        catch (...) {
+            ::operator delete(t.slots);
+            throw;
+        }
+        counters.allocated();
+        std::memset(t.ctrl, HashGroup::empty, capacity);
+        t.capacity = capacity;
+        t.growthLeft = capacity - capacity / 8;
+        return t;
+    }
+
+    void release(Table& t) {
+        if (t.capacity != 0) {
+            counters.freed();
+        }
+        for (size_t i = 0; i < t.capacity && t.used > 0; ++i) {
+            if (t.ctrl[i] >= 0) {
+                t.slots[i].~Slot();
+                --t.used;
+            }
+        }
+        delete[] t.ctrl;
+        ::operator delete(t.slots);
+        t = Table();
+    }
+
+    // Smallest table holding n entries without growing
+    static size_t capacityFor(size_t n) {
+        size_t capacity = HashGroup::width;
+        while (capacity - capacity / 8 < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // Visits the groups of a table in the probe order of hash h until f returns true.
+    // The steps grow by one group each, which reaches every group of a power-of-two table.
+    template<typename F>
+    static void probe(const Table& t, size_t h, F f) {
+        size_t mask = t.capacity / HashGroup::width - 1;
+        size_t group = (h >> 7) & mask;
+        for (size_t step = 1; !f(group * HashGroup::width); ++step) {
+            group = (group + step) & mask;
+        }
+    }
+
+    template<typename K>
+    size_t findSlot(const Table& t, const K& k, size_t h) const {
+        size_t result = npos;
+        if (t.capacity == 0) {
+            return result;
+        }
+        probe(t, h, [&](size_t first) {
+            HashGroup group(t.ctrl + first);
+            for (uint32_t mask = group.match(h2(h)); mask != 0; mask &= mask - 1) {
+                size_t index = first + HashGroup::lowestBit(mask);
+                const Slot& slot = t.slots[index];
+                counters.visited();
+                if (slot.hash != h) {
+                    continue;
+                }
+                counters.compared();
+                if (equal(slot.key, k)) {
+                    result = index;
+                    return true;
+                }
+            }
+            // An empty slot ends the probe sequence: an insert would have used it
+            return group.matchEmpty() != 0;
+        });
+        return result;
+    }
+
+    static size_t freeSlot(const Table& t, size_t h) {
+        size_t result = npos;
+        probe(t, h, [&](size_t first) {
+            uint32_t mask = HashGroup(t.ctrl + first).matchFree();
+            if (mask != 0) {
+                result = first + HashGroup::lowestBit(mask);
+                return true;
+            }
+            return false;
+        });
+        return result;
+    }
+
+    template<typename K, typename I>
+    static void construct(Table& t, size_t index, size_t h, K&& k, I&& i) {
+        new (&t.slots[index]) Slot(h, std::forward<K>(k), std::forward<I>(i));
+        if (t.ctrl[index] == HashGroup::empty) {
+            --t.growthLeft;
+        }
+        t.ctrl[index] = h2(h);
+        ++t.used;
+    }
+
+    // A slot may become empty again only if its group never filled up, since then
+    // no probe sequence has passed through the group
+    static void erase(Table& t, size_t index) {
+        t.slots[index].~Slot();
+        size_t first = index & ~(HashGroup::width - 1);
+        if (HashGroup(t.ctrl + first).matchEmpty() != 0) {
+            t.ctrl[index] = HashGroup::empty;
+            ++t.growthLeft;
+        }
+        else {
+            t.ctrl[index] = HashGroup::deleted;
+        }
+        --t.used;
+    }
+
+    template<typename K, typename KeyArg, typename InfoArg>
+    bool place(const K& k, KeyArg&& key, InfoArg&& info) {
+        size_t h = hashOf(k);
+        if (findSlot(current, k, h) != npos || (old.capacity != 0 && findSlot(old, k, h) != npos)) {
+            return false;
+        }
+        size_t index = current.capacity != 0 ? freeSlot(current, h) : npos;
+        if (index == npos || (current.ctrl[index] == HashGroup::empty && current.growthLeft == 0)) {
+            grow();
+            index = freeSlot(current, h);
+        }
+        construct(current, index, h, std::forward<KeyArg>(key), std::forward<InfoArg>(info));
+        migrate(migrationStep);
+        return true;
+    }
+
+    // Starts moving into a table twice as large, or as large if most of the
+    // used-up slots are deleted ones
+    void grow() {
+        migrate(old.capacity);
+        size_t capacity = current.capacity == 0 ? HashGroup::width
+            : current.used * 16 > current.capacity * 7 ? current.capacity * 2 : current.capacity;
+        Table next = allocate(capacity);
+        old = current;
+        current = next;
+        migrated = 0;
+    }
+
+    // Moves up to n slots of the old table into the current one, by their stored hashes
+    void migrate(size_t n) {
+        if (old.capacity == 0) {
+            return;
+        }
+        size_t end = std::min(old.capacity, migrated + n);
+        for (; migrated < end; ++migrated) {
+            if (old.ctrl[migrated] >= 0) {
+                Slot& slot = old.slots[migrated];
+                construct(current, freeSlot(current, slot.hash), slot.hash, std::move(slot.key), std::move(slot.info));
+                slot.~Slot();
+                old.ctrl[migrated] = HashGroup::deleted;
+                --old.used;
+            }
+        }
+        if (migrated == old.capacity) {
+            release(old);
+            migrated = 0;
+        }
+    }
+
+    void copyFrom(const HashDictionary& that) {
+        if (that.count() == 0) {
+            return;
+        }
+        current = allocate(capacityFor((size_t)that.count()));
+        try {
+            for (const Table* t : { &that.current, &that.old }) {
+                for (size_t i = 0; i < t->capacity; ++i) {
+                    if (t->ctrl[i] >= 0) {
+                        const Slot& slot = t->slots[i];
+                        construct(current, freeSlot(current, slot.hash), slot.hash, slot.key, slot.info);
+                    }
+                }
+            }
+        }
+        catch (...) {
+            release(current);
+            throw;
+        }
+    }
+
+    template<typename K>
+    const Slot* find(const K& k) const {
+        const LookupKey<K>& key = k;
+        size_t h = hashOf(key);
+        size_t index = findSlot(current, key, h);
+        if (index != npos) {
+            return &current.slots[index];
+        }
+        if (old.capacity != 0) {
+            index = findSlot(old, key, h);
+            if (index != npos) {
+                return &old.slots[index];
+            }
+        }
+        return nullptr;
+    }
+
+    Table current;
+    Table old;           // the table being moved into current while growing
+    size_t migrated;     // old slots before this index are moved
+    Hash hasher;
+    KeyEqual equal;
+    [[no_unique_address]] StatsCounters counters;
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef EADS_INLINE_STORAGE_H
+#define EADS_INLINE_STORAGE_H
+
+#include <cstddef>
+#include <new>
+
+namespace eads {
+
+// Room for up to N objects of T inside the owning container, for its small
+// mode (see Sequence and Dictionary). Slots [0, size()) hold constructed
+// objects; the owner constructs, moves and destroys them and calls resize().
+// Copies start empty, like the stats counters.
+template<typename T, size_t N>
+class InlineStorage {
+public:
+    InlineStorage() : used(0) { }
+
+    InlineStorage(const InlineStorage&) : used(0) { }
+
+    InlineStorage& operator =(const InlineStorage&) {
+        return *this;
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    void resize(size_t n) {
+        used = n;
+    }
+
+    T* at(size_t i) {
+        return std::launder(reinterpret_cast<T*>(bytes + i * sizeof(T)));
+    }
+
+    const T* at(size_t i) const {
+        return std::launder(reinterpret_cast<const T*>(bytes + i * sizeof(T)));
+    }
+
+    // Raw memory of slot i, for constructing its object
+    void* slot(size_t i) {
+        return bytes + i * sizeof(T);
+    }
+
+private:
+    size_t used;
+    alignas(T) unsigned char bytes[N * sizeof(T)];
+};
+
+// Without a capacity nothing is stored; the owner's small-mode code is never reached
+template<typename T>
+class InlineStorage<T, 0> {
+public:
+    size_t size() const { return 0; }
+    void resize(size_t) { }
+    T* at(size_t) { return nullptr; }
+    const T* at(size_t) const { return nullptr; }
+    void* slot(size_t) { return nullptr; }
+};
+
+}
+
+#endif
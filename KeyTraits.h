@@ -0,0 +1,90 @@
+#ifndef EADS_KEY_TRAITS_H
+#define EADS_KEY_TRAITS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace eads {
+
+// Whether a comparator accepts any type comparable with the key, like std::less<>
+template<typename Compare, typename = void>
+struct IsTransparent : std::false_type { };
+
+template<typename Compare>
+struct IsTransparent<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type { };
+
+template<typename Compare>
+struct IsStdLess : std::false_type { };
+
+template<typename T>
+struct IsStdLess<std::less<T>> : std::true_type { };
+
+// Whether a comparator has compare(a, b) returning a negative, zero or positive result
+template<typename Compare, typename A, typename B, typename = void>
+struct HasThreeWay : std::false_type { };
+
+template<typename Compare, typename A, typename B>
+struct HasThreeWay<Compare, A, B,
+    std::void_t<decltype(std::declval<const Compare&>().compare(std::declval<const A&>(), std::declval<const B&>()))>> : std::true_type { };
+
+// Types std::less orders as byte strings
+template<typename T>
+struct IsStringKey : std::integral_constant<bool, std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value
+    || std::is_same<typename std::decay<T>::type, const char*>::value || std::is_same<typename std::decay<T>::type, char*>::value> { };
+
+// Compares a with b once: negative if a goes first, zero if equivalent, positive otherwise.
+// Uses Compare::compare() when there is one, else string or arithmetic comparison for
+// std::less, else two calls of comp.
+template<typename Compare, typename A, typename B>
+int threeWay(const Compare& comp, const A& a, const B& b) {
+    if constexpr (HasThreeWay<Compare, A, B>::value) {
+        auto result = comp.compare(a, b);
+        return result < 0 ? -1 : (result > 0 ? 1 : 0);
+    }
+    else if constexpr (IsStdLess<Compare>::value && IsStringKey<A>::value && IsStringKey<B>::value) {
+        return std::string_view(a).compare(std::string_view(b));
+    }
+    else if constexpr (IsStdLess<Compare>::value && std::is_arithmetic<A>::value && std::is_arithmetic<B>::value) {
+        return (int)(b < a) - (int)(a < b);
+    }
+    else {
+        return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+    }
+}
+
+// The first 8 bytes of a string key, big-endian and zero-padded, which Dictionary keeps
+// inline in every node: two different prefixes order their strings like the strings
+// themselves, so most steps of a descent do not read the key's heap buffer.
+// Empty for other keys and comparators.
+template<typename Key, typename Compare, typename = void>
+struct KeyPrefix {
+    template<typename K>
+    static KeyPrefix of(const K&) {
+        return KeyPrefix();
+    }
+};
+
+template<typename Key, typename Compare>
+struct KeyPrefix<Key, Compare, typename std::enable_if<std::is_same<Key, std::string>::value && IsStdLess<Compare>::value>::type> {
+    uint64_t bytes = 0;
+
+    static KeyPrefix of(std::string_view s) {
+        unsigned char buffer[8] = { };
+        std::memcpy(buffer, s.data(), std::min(s.size(), sizeof(buffer)));
+        KeyPrefix prefix;
+        for (unsigned char c : buffer) {
+            prefix.bytes = prefix.bytes << 8 | c;
+        }
+        return prefix;
+    }
+};
+
+}
+
+#endif
@@ -6,343 +6,675 @@
 //
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <vector>
+#include "ConcurrentDictionary.h"
+#include "Dictionary.h"
+#include "HashDictionary.h"
+#include "PersistentDictionary.h"
 using namespace std;
+using namespace eads;
 
 template<typename Key, typename Info>
-class Dictionary {
-public:
-    Dictionary() : root(nullptr) {
+void drawInsert(Dictionary<Key, Info>& d, const Key& k, const Info& i) {
+    cout << "Added '" << k << "'" << endl;
+    d.insert(k, i);
+    d.print(cout);
+}
 
-    }
+void draw_tree() {
+    // See if our tree is self-balancing by visualizing
+    Dictionary<int, int> coutTree;
+    drawInsert(coutTree, 12, 0);
+    drawInsert(coutTree, 8, 0);
+    drawInsert(coutTree, 11, 0);
+    drawInsert(coutTree, 4, 0);
+    drawInsert(coutTree, 10, 0);
+    drawInsert(coutTree, 18, 0);
+    drawInsert(coutTree, 17, 0);
+    drawInsert(coutTree, 5, 0);
+}
 
-    Dictionary(const Dictionary& copy) : root(nullptr) {
-        if (copy.root != nullptr) {
-            root = new Node(*copy.root);
+// Measures lookup throughput of the pointer-based tree against its frozen snapshot
+void bench_freeze(size_t maxKeys) {
+    const size_t lookups = 2000000;
+    mt19937_64 rng(42);
+    cout << "keys\tdictionary Mlookups/s\tfrozen Mlookups/s" << endl;
+    for (size_t n = 10000; n <= maxKeys; n *= 10) {
+        // Even keys are present, so about half of the random probes hit
+        vector<pair<int64_t, int64_t>> entries;
+        entries.reserve(n);
+        for (size_t j = 0; j < n; ++j) {
+            entries.emplace_back((int64_t)(2 * j), (int64_t)j);
         }
-    }
+        Dictionary<int64_t, int64_t> tree(sortedInput, entries.begin(), entries.end());
+        entries = vector<pair<int64_t, int64_t>>();
+        FrozenDictionary<int64_t, int64_t> frozen = tree.freeze();
 
-    ~Dictionary() {
-        clear();
-    }
+        vector<int64_t> probes(lookups);
+        for (size_t j = 0; j < lookups; ++j) {
+            probes[j] = (int64_t)(rng() % (2 * n));
+        }
 
-    Dictionary& operator =(const Dictionary& that) {
-        if (this != &that) {
-            clear();
-            if (that.root != nullptr) {
-                root = new Node(that.root);
-            }
+        size_t hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t j = 0; j < lookups; ++j) {
+            hits += tree.hasKey(probes[j]);
         }
-        return *this;
-    }
+        double treeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        for (size_t j = 0; j < lookups; ++j) {
+            hits -= frozen.hasKey(probes[j]);
+        }
+        double frozenSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    void print(ostream& os) {
-        int max = getHeight();
-        for (int i = 0; i < max; ++i) {
-            printRow(os, i, max);
+        if (hits != 0) {
+            throw runtime_error("Frozen snapshot disagrees with the tree");
         }
+        cout << n << "\t" << lookups / treeSeconds / 1e6 << "\t" << lookups / frozenSeconds / 1e6 << endl;
     }
+}
 
-    int count() const {
-        return count(root);
+// Inserts n string keys, then looks each up; reports the mean and worst insert latency and the
+// lookup throughput. The worst insert shows whether growing stalls a single call.
+template<typename Dict>
+void bench_hash_run(const char* name, size_t n) {
+    vector<string> keys(n);
+    for (size_t j = 0; j < n; ++j) {
+        keys[j] = "key:" + to_string(j * 2654435761u % 1000000007u);
+    }
+    Dict dict;
+    double worst = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t j = 0; j < n; ++j) {
+        auto before = chrono::steady_clock::now();
+        dict.insert(keys[j], (int)j);
+        worst = max(worst, chrono::duration<double>(chrono::steady_clock::now() - before).count());
     }
+    double insertSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    void clear() {
-        if (root != nullptr) {
-            delete root;
-            root = nullptr;
-        }
+    size_t hits = 0;
+    start = chrono::steady_clock::now();
+    for (size_t j = 0; j < n; ++j) {
+        hits += dict.hasKey(keys[(j * 7919) % n]);
     }
+    double lookupSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (hits != n) {
+        throw runtime_error("Lookups missed inserted keys");
+    }
+    cout << name << "\t" << n << "\t" << insertSeconds * 1e9 / n << "\t" << worst * 1e6
+         << "\t" << n / lookupSeconds / 1e6 << endl;
+}
 
-    void insert(const Key& k, const Info& i) {
-        root = insert(root, k, i);
+// Compares the ordered tree against the hash table for string keys
+void bench_hash() {
+    cout << "dictionary\tkeys\tinsert ns\tworst insert us\tMlookups/s" << endl;
+    for (size_t n = 1000; n <= 1000000; n *= 10) {
+        bench_hash_run<Dictionary<string, int>>("tree", n);
+        bench_hash_run<HashDictionary<string, int>>("hash", n);
     }
+}
 
-    void remove(const Key& k) {
-        root = remove(root, k);
+// Comparators for bench_compare which count their calls: CountingLess has only operator(),
+// so the descent falls back to two calls per node; CountingThreeWay adds compare()
+struct CountingLess {
+    using is_transparent = void;
+    static size_t calls;
+
+    bool operator ()(string_view a, string_view b) const {
+        ++calls;
+        return a < b;
     }
+};
 
-    bool hasKey(const Key& k) {
-        return findNode(k) != nullptr;
+struct CountingThreeWay : CountingLess {
+    int compare(string_view a, string_view b) const {
+        ++calls;
+        return a.compare(b);
     }
+};
 
-    bool tryGetInfo(const Key& k, Info& i) {
-        Node* n = findNode(k);
-        if (n != nullptr) {
-            i = n->info;
-            return true;
+size_t CountingLess::calls = 0;
+
+// Builds a tree of the keys, then looks up every key once in shuffled order
+template<typename Compare>
+void bench_compare_run(const char* name, const vector<string>& keys) {
+    Dictionary<string, int, Compare> dict;
+    for (size_t j = 0; j < keys.size(); ++j) {
+        dict.insert(keys[j], (int)j);
+    }
+    vector<string> probes = keys;
+    shuffle(probes.begin(), probes.end(), mt19937_64(3));
+    // The best of three passes, since the timing is dominated by cache misses
+    const int passes = 3;
+    double seconds = 0;
+    CountingLess::calls = 0;
+    for (int pass = 0; pass < passes; ++pass) {
+        size_t hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (const string& probe : probes) {
+            hits += dict.hasKey(probe);
+        }
+        double passSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        seconds = pass == 0 ? passSeconds : min(seconds, passSeconds);
+        if (hits != keys.size()) {
+            throw runtime_error("Lookups missed inserted keys");
         }
-        return false;
     }
-    
-    Info& getInfo(const Key& k) {
-        return findNode(k)->info;
+    cout << "\t" << name << "\t" << (double)CountingLess::calls / passes / probes.size() << "\t"
+         << seconds * 1e9 / probes.size();
+}
+
+// Comparator calls and ns per successful lookup: two-way less (the old descent), a
+// three-way comparator, and std::less<> with the inline key prefix (which calls no comparator)
+void bench_compare() {
+    const size_t n = 200000;
+    const char* const patterns[] = { "", "https://example.org/items/" };
+    cout << "keys\tcomparator\tcalls/lookup\tns/lookup\t..." << endl;
+    for (const char* pattern : patterns) {
+        vector<string> keys(n);
+        for (size_t j = 0; j < n; ++j) {
+            keys[j] = pattern + to_string(j * 2654435761u % 1000000007u);
+        }
+        cout << (*pattern != 0 ? "shared prefix" : "random");
+        bench_compare_run<CountingLess>("two-way", keys);
+        bench_compare_run<CountingThreeWay>("three-way", keys);
+        bench_compare_run<less<>>("prefix", keys);
+        cout << endl;
     }
+}
 
-private:
-    struct Node {
-        Key key;
-        Info info;
-        Node* nodeL;
-        Node* nodeR;
+// Runs one operation mix on a tree with the given balancing policy and prints a result row
+template<typename Balance>
+void bench_balance_mix(const char* policy, const char* mix, int insertPercent, int removePercent, size_t prefill) {
+    const int keySpace = 1 << 20;
+    const size_t ops = 2000000;
+    mt19937_64 rng(7);
+    Dictionary<int64_t, int64_t, less<>, Balance> tree;
+    for (size_t j = 0; j < prefill; ++j) {
+        int64_t k = (int64_t)(rng() % keySpace);
+        tree.tryEmplace(k, k);
+    }
+    vector<pair<int, int64_t>> script(ops);
+    for (pair<int, int64_t>& op : script) {
+        int roll = (int)(rng() % 100);
+        op.first = roll < insertPercent ? 0 : roll < insertPercent + removePercent ? 1 : 2;
+        op.second = (int64_t)(rng() % keySpace);
+    }
+    tree.resetRotations();
 
-        Node(const Key& k, const Info& i, Node* l = nullptr, Node* r = nullptr)
-            : key(k), info(i), nodeL(l), nodeR(r)
-        {
+    size_t hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (const pair<int, int64_t>& op : script) {
+        if (op.first == 0) {
+            tree.tryEmplace(op.second, op.second);
         }
-
-        Node(const Node& copy) : Node(copy.key, copy.info) {
-            if (copy.nodeL != nullptr) {
-                nodeL = new Node(*(copy.nodeL));
-            }
-            if (copy.nodeR != nullptr) {
-                nodeR = new Node(*(copy.nodeR));
-            }
+        else if (op.first == 1) {
+            tree.remove(op.second);
         }
-
-        ~Node() {
-            if (nodeL != nullptr) {
-                delete nodeL;
-            }
-            if (nodeR != nullptr) {
-                delete nodeR;
-            }
+        else {
+            hits += tree.hasKey(op.second);
         }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << policy << "\t" << mix << "\t" << seconds * 1e9 / ops << "\t" << (double)tree.rotations() / ops
+         << "\t" << tree.height() << "\t" << tree.count() << "\t" << hits << endl;
+}
 
-        int getType() const {
-            int type = 0;
-            if (nodeL != nullptr) type += 1;
-            if (nodeR != nullptr) type += 2;
-            return type;
-        }
-    };
+template<typename Balance>
+void bench_balance_policy(const char* policy) {
+    bench_balance_mix<Balance>(policy, "insert-heavy", 80, 10, 0);
+    bench_balance_mix<Balance>(policy, "delete-heavy", 10, 80, 1 << 20);
+    bench_balance_mix<Balance>(policy, "lookup-heavy", 5, 5, 1 << 19);
+}
 
-    void printRow(ostream& os, int row, int max) {
-        vector<Node*> nodes;
-        printRow(nodes, root, row, 0);
-        int width = (max - row) * 3;
-        os << string(width, ' ');
-        for (typename vector<Node*>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
-            Node* node = *it;
-            if (node != nullptr) {
-                os << node->key;
-            }
-            else {
-                os << "N";
+// Compares the balancing policies: ns per operation, rotations per operation and
+// the final tree height for insert-, delete- and lookup-heavy mixes of random keys
+void bench_balance() {
+    cout << "policy\tmix\tns/op\trotations/op\theight\tkeys\thits" << endl;
+    bench_balance_policy<AvlBalance>("avl");
+    bench_balance_policy<RedBlackBalance>("red-black");
+    bench_balance_policy<TreapBalance>("treap");
+}
+
+// Measures throughput of mixed read/write workloads for 1 to 64 threads,
+// comparing a single shard (the old global lock) against 64 shards
+void bench_concurrent() {
+    const int keySpace = 1 << 14;
+    const size_t opsPerRun = 1 << 18;
+    const int readPercents[] = { 100, 95, 50 };
+    cout << "threads\tread%\t1 shard Mops/s\t64 shards Mops/s" << endl;
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        for (int readPercent : readPercents) {
+            double mops[2];
+            size_t shardCounts[] = { 1, 64 };
+            for (int v = 0; v < 2; ++v) {
+                ConcurrentDictionary<int, int> dict(shardCounts[v]);
+                vector<pair<int, int>> preload;
+                for (int k = 0; k < keySpace; k += 2) {
+                    preload.emplace_back(k, k);
+                }
+                dict.insertBatch(preload);
+
+                vector<thread> workers;
+                auto start = chrono::steady_clock::now();
+                for (int t = 0; t < threads; ++t) {
+                    workers.emplace_back([&dict, t, threads, readPercent, opsPerRun, keySpace]() {
+                        mt19937 rng((unsigned)t + 1);
+                        int hits = 0;
+                        for (size_t op = 0; op < opsPerRun / threads; ++op) {
+                            int k = (int)(rng() % keySpace);
+                            if ((int)(rng() % 100) < readPercent) {
+                                hits += dict.hasKey(k);
+                            }
+                            else if (rng() % 2 == 0) {
+                                dict.tryInsert(k, k);
+                            }
+                            else {
+                                dict.remove(k);
+                            }
+                        }
+                        if (hits < 0) {
+                            cout << hits;
+                        }
+                    });
+                }
+                for (thread& worker : workers) {
+                    worker.join();
+                }
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                mops[v] = opsPerRun / seconds / 1e6;
             }
-            os << string((int)ceil(1.5 * (max - row)), ' ');
+            cout << threads << "\t" << readPercent << "\t" << mops[0] << "\t" << mops[1] << endl;
         }
-        os << endl << endl;
     }
+}
 
-    void printRow(vector<Node*>& nodes, Node* n, int row, int lvl) {
-        if (lvl == row) {
-            nodes.push_back(n);
+// Times copying and destroying a tree of n random keys on task pools of 1 to
+// hardware_concurrency threads (the calling thread plus the workers)
+void bench_copy(size_t n) {
+    mt19937_64 rng(11);
+    Dictionary<int64_t, int64_t> tree;
+    while ((size_t)tree.count() < n) {
+        int64_t k = (int64_t)(rng() >> 1);
+        tree.tryEmplace(k, k);
+    }
+    unsigned maxThreads = max(thread::hardware_concurrency(), 1u);
+    vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+    double serialCopy = 0;
+    double serialDestroy = 0;
+    cout << "threads\tcopy s\tcopy speedup\tdestroy s\tdestroy speedup" << endl;
+    for (unsigned threads : threadCounts) {
+        TaskPool pool(threads - 1);
+        auto start = chrono::steady_clock::now();
+        Dictionary<int64_t, int64_t> copy(tree, pool);
+        double copySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (copy.count() != tree.count() || copy.height() != tree.height()) {
+            throw runtime_error("The parallel copy differs from the tree");
         }
-        else {
-            if (n != nullptr) {
-                printRow(nodes, n->nodeL, row, lvl + 1);
-                printRow(nodes, n->nodeR, row, lvl + 1);
-            }
+        start = chrono::steady_clock::now();
+        copy.clear(pool);
+        double destroySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (threads == 1) {
+            serialCopy = copySeconds;
+            serialDestroy = destroySeconds;
         }
+        cout << threads << "\t" << copySeconds << "\t" << serialCopy / copySeconds
+             << "\t" << destroySeconds << "\t" << serialDestroy / destroySeconds << endl;
     }
+}
 
-    int count(Node* n) const {
-        if (n == nullptr)
-            return 0;
-        return count(n->nodeL) + count(n->nodeR) + 1;
+// Builds and searches many dictionaries of up to 16 keys, as node trees and in the inline small mode
+template<typename Tiny>
+void bench_small_run(const char* name, size_t keys) {
+    const size_t rounds = 200000;
+    mt19937 rng(13);
+    auto start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+        Tiny d;
+        for (size_t j = 0; j < keys; ++j) {
+            d.tryEmplace((int)(rng() % 64), (int)j);
+        }
+        for (int j = 0; j < 64; j += 4) {
+            found += d.hasKey(j) ? 1 : 0;
+        }
     }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << name << "\t" << keys << "\t" << seconds * 1e9 / (double)rounds << "\t" << found << endl;
+}
 
-    int getHeight() const {
-        return getHeight(root);
+void bench_small() {
+    cout << "mode\tkeys\tns per dictionary\thits" << endl;
+    for (size_t keys : { 4, 8, 16 }) {
+        bench_small_run<Dictionary<int, int>>("tree", keys);
+        bench_small_run<Dictionary<int, int, less<>, AvlBalance, 16>>("inline", keys);
     }
+}
 
-    int getHeight(Node* n) const {
-        if (n == nullptr)
-            return 0;
-        return max(getHeight(n->nodeL), getHeight(n->nodeR)) + 1;
+// Writers, a batch insert and readers share a ConcurrentDictionary; the result
+// must equal the same operations applied serially to a std::map
+void test_concurrent_dictionary() {
+    const int writers = 4;
+    const int keysPerWriter = 2000;
+    ConcurrentDictionary<int, int> dict(8);
+    atomic<bool> done(false);
+    atomic<int> wrongReads(0);
+    vector<thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&dict, w]() {
+            for (int j = w; j < writers * keysPerWriter; j += writers) {
+                dict.insert(j, 2 * j);
+                if (j % 10 == 0) {
+                    dict.remove(j);
+                }
+            }
+        });
     }
-    
-    int getBalance(Node* n) const {
-        if (n == nullptr) {
-            return 0;
+    threads.emplace_back([&dict]() {
+        vector<pair<int, int>> batch;
+        for (int j = 100000; j < 101000; ++j) {
+            batch.emplace_back(j, 2 * j);
         }
-        return getHeight(n->nodeL) - getHeight(n->nodeR);
+        dict.insertBatch(batch);
+    });
+    for (int r = 0; r < 2; ++r) {
+        threads.emplace_back([&]() {
+            while (!done.load()) {
+                for (int j = 0; j < writers * keysPerWriter; j += 7) {
+                    int info;
+                    if (dict.tryGetInfo(j, info) && info != 2 * j) {
+                        ++wrongReads;
+                    }
+                }
+            }
+        });
     }
-
-    Node* rotateL(Node* n) {
-        Node* l = n->nodeR;
-        Node* r = l->nodeL;
-        l->nodeL = n;
-        n->nodeR = r;
-        return l;
+    for (int t = 0; t <= writers; ++t) {
+        threads[t].join();
     }
-
-    Node* rotateR(Node* n) {
-        Node* r = n->nodeL;
-        Node* l = r->nodeR;
-        r->nodeR = n;
-        n->nodeL = l;
-        return r;
+    done = true;
+    for (size_t t = writers + 1; t < threads.size(); ++t) {
+        threads[t].join();
     }
 
-    Node* insert(Node* n, const Key& k, const Info& i) {
-        if (n == nullptr) {
-            n = new Node(k, i);
-            return n;
+    map<int, int> expected;
+    for (int j = 0; j < writers * keysPerWriter; ++j) {
+        if (j % 10 != 0) {
+            expected[j] = 2 * j;
         }
+    }
+    for (int j = 100000; j < 101000; ++j) {
+        expected[j] = 2 * j;
+    }
+    assert(wrongReads == 0 && dict.count() == (int)expected.size());
+    for (const pair<const int, int>& entry : expected) {
+        assert(dict.getInfo(entry.first) == entry.second);
+    }
+    assert(!dict.hasKey(0) && !dict.hasKey(100) && !dict.hasKey(101000));
+}
 
-        if (k < n->key) {
-            n->nodeL = insert(n->nodeL, k, i);
+// A reader keeps working on its snapshot while the writer publishes new versions
+void test_published_dictionary() {
+    PublishedDictionary<int, int> published;
+    published.update([](PersistentDictionary<int, int>& d) {
+        for (int j = 0; j < 100; ++j) {
+            d.insert(j, j);
         }
-        else if (k > n->key) {
-            n->nodeR = insert(n->nodeR, k, i);
+    });
+    const int versions = 50;
+    atomic<bool> holding(false);
+    atomic<bool> published50(false);
+    bool oldUnchanged = true;
+    thread reader([&]() {
+        PersistentDictionary<int, int> old = published.snapshot();
+        holding = true;
+        while (!published50.load()) {
+            oldUnchanged = oldUnchanged && old.count() == 100 && !old.hasKey(100) && old.getInfo(99) == 99;
         }
-        else {
-            throw runtime_error("Duplicate keys are forbidden");
-        }
-
-        int balance = getBalance(n);
+        oldUnchanged = oldUnchanged && old.count() == 100 && !old.hasKey(100 + versions - 1);
+    });
+    while (!holding.load()) {
+        this_thread::yield();
+    }
+    for (int v = 0; v < versions; ++v) {
+        published.update([v](PersistentDictionary<int, int>& d) {
+            d.insert(100 + v, v);
+            d.remove(v);
+        });
+    }
+    published50 = true;
+    reader.join();
+    PersistentDictionary<int, int> latest = published.snapshot();
+    assert(oldUnchanged);
+    assert(latest.count() == 100 && !latest.hasKey(0) && latest.getInfo(100 + versions - 1) == versions - 1);
+    assert(latest.getInfo(versions) == versions);
+}
 
-        if (balance > 1) {
-            if (k < n->nodeL->key) {
-                return rotateR(n);
-            }
-            if (k > n->nodeL->key) {
-                n->nodeL = rotateL(n->nodeL);
-                return rotateR(n);
-            }
+// Writes bytes as the snapshot file and tells whether loading it throws
+// Whether two dictionaries hold the same entries in the same order
+template<typename Dict>
+bool same_entries(const Dict& a, const Dict& b) {
+    if (a.count() != b.count()) {
+        return false;
+    }
+    for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+        if (i.getKey() != j.getKey() || i.getInfo() != j.getInfo()) {
+            return false;
         }
+    }
+    return true;
+}
 
-        if (balance < -1) {
-            if (k > n->nodeR->key) {
-                return rotateL(n);
-            }
-            if (k < n->nodeR->key) {
-                n->nodeR = rotateR(n->nodeR);
-                return rotateL(n);
-            }
+// Runs the set operations with Join and ParallelJoin against the Linear merge, on trees of
+// similar and of very different sizes, large enough for ParallelJoin to fork
+template<typename Balance>
+void test_set_algorithms() {
+    using Dict = Dictionary<int, int, less<>, Balance>;
+    Dict evens;
+    Dict thirds;
+    Dict sparse;
+    for (int j = 0; j < 120000; ++j) {
+        if (j % 2 == 0 && j < 80000) {
+            evens.insert(j, j);
+        }
+        if (j % 3 == 0) {
+            thirds.insert(j, -j);
+        }
+        if (j % 997 == 0) {
+            sparse.insert(j, 1);
         }
-
-        return n;
     }
-
-    Node* remove(Node* n, const Key& k) {
-        if (n == nullptr) {
-            return n;
+    auto run = [](Dict& d, const Dict& other, int op, SetAlgorithm algorithm) {
+        if (op == 0) {
+            d.unionWith(other, ConflictPolicy::KeepTheirs, algorithm);
         }
-
-        if (n->key < k) {
-            n->nodeL = remove(n->nodeL, k);
+        else if (op == 1) {
+            d.unionWith(other, [](int, int ours, int theirs) { return ours + theirs; }, algorithm);
         }
-        else if (n->key > k) {
-            n->nodeR = remove(n->nodeR, k);
+        else if (op == 2) {
+            d.intersect(other, algorithm);
         }
         else {
-            Node* temp = nullptr;
-            switch (n->getType()) {
-                case 3:
-                    temp = n->nodeR;
-                    while (temp->nodeL != nullptr) {
-                        temp = temp->nodeL;
-                    }
-                    n->key = temp->key;
-                    n->info = temp->info;
-                    n->nodeR = remove(n->nodeR, temp->key);
-                    temp = nullptr;
-                    break;
-                case 2:
-                    temp = n->nodeR;
-                    break;
-                case 1:
-                    temp = n->nodeL;
-                    break;
-                case 0:
-                    delete n;
-                    n = nullptr;
-                    break;
-            }
-            if (temp != nullptr) {
-                n->key = temp->key;
-                n->info = temp->info;
-                n->nodeL = temp->nodeL;
-                n->nodeR = temp->nodeR;
-                temp->nodeL = nullptr;
-                temp->nodeR = nullptr;
-                delete temp;
+            d.difference(other, algorithm);
+        }
+    };
+    const pair<const Dict*, const Dict*> operands[] = { { &evens, &thirds }, { &evens, &sparse }, { &sparse, &thirds } };
+    for (const pair<const Dict*, const Dict*>& both : operands) {
+        for (int op = 0; op < 4; ++op) {
+            Dict linear = *both.first;
+            run(linear, *both.second, op, SetAlgorithm::Linear);
+            assert(linear.isConsistent());
+            for (SetAlgorithm algorithm : { SetAlgorithm::Join, SetAlgorithm::ParallelJoin }) {
+                Dict joined = *both.first;
+                run(joined, *both.second, op, algorithm);
+                assert(joined.isConsistent() && same_entries(joined, linear));
             }
         }
+    }
+}
 
-        if (n == nullptr) {
-            return n;
-        }
+// Whether forEachInRange takes fn on a Dict, i.e. whether the call compiles
+template<typename Dict, typename Fn, typename = void>
+struct AcceptsRangeCallback : false_type { };
 
-        int balance = getBalance(n);
+template<typename Dict, typename Fn>
+struct AcceptsRangeCallback<Dict, Fn, void_t<decltype(declval<Dict&>().forEachInRange(0, 0, declval<Fn>()))>> : true_type { };
 
-        if (balance > 1) {
-            if (getBalance(n->nodeL) >= 0) {
-                return rotateR(n);
-            }
-            if (getBalance(n->nodeL) < 0) {
-                n->nodeL = rotateL(n->nodeL);
-                return rotateR(n);
-            }
-        }
-        if (balance < -1) {
-            if (getBalance(n->nodeR) <= 0) {
-                return rotateL(n);
-            }
-            if (getBalance(n->nodeR) > 0) {
-                n->nodeR = rotateR(n->nodeR);
-                return rotateL(n);
-            }
-        }
-
-        return n;
+bool snapshot_rejected(const string& path, const string& bytes) {
+    {
+        ofstream os(path, ios::binary | ios::trunc);
+        os.write(bytes.data(), (streamsize)bytes.size());
+    }
+    try {
+        Dictionary<int, int> loaded;
+        loaded.loadSnapshot(path);
     }
+    catch (const runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Snapshots round-trip through a file, and damaged files are rejected
+void test_snapshots() {
+    const string path = "Lab3.snapshot";
 
-    Node* findNode(const Key& k) {
-        return findNode(root, k);
+    Dictionary<int, double> numbers;
+    for (int j = 0; j < 1000; ++j) {
+        numbers.insert(j * 3, j / 2.0);
     }
+    numbers.saveSnapshot(path);
+    Dictionary<int, double> numbersLoaded;
+    numbersLoaded.insert(-1, 0);
+    numbersLoaded.loadSnapshot(path);
+    assert(numbersLoaded.count() == 1000 && !numbersLoaded.hasKey(-1));
+    assert(numbersLoaded.getInfo(0) == 0 && numbersLoaded.getInfo(2997) == 499.5);
+    MappedDictionary<int, double> mappedNumbers(path);
+    assert(mappedNumbers.count() == 1000 && mappedNumbers.getInfo(300) == 50);
+    assert(!mappedNumbers.hasKey(301) && !mappedNumbers.hasKey(-3) && !mappedNumbers.hasKey(3000));
 
-    Node* findNode(Node* n, const Key& k) {
-        if (n == nullptr || n->key == k) {
-            return n;
-        }
-        if (n->key < k) {
-            return findNode(n->nodeR, k);
-        }
-        else {
-            return findNode(n->nodeL, k);
-        }
+    Dictionary<string, string> names;
+    names.insert("beta", "2");
+    names.insert("alpha", "1");
+    names.insert("", "empty");
+    names.insert("gamma", string(300, 'g'));
+    names.saveSnapshot(path);
+    Dictionary<string, string> namesLoaded;
+    namesLoaded.loadSnapshot(path);
+    assert(namesLoaded.count() == 4 && namesLoaded.getInfo("") == "empty");
+    assert(namesLoaded.getInfo("alpha") == "1" && namesLoaded.getInfo("gamma") == string(300, 'g'));
+    MappedDictionary<string, string> mappedNames(path);
+    string info;
+    assert(mappedNames.tryGetInfo(string_view("beta"), info) && info == "2");
+    assert(mappedNames.getInfo("") == "empty" && !mappedNames.hasKey("delta") && !mappedNames.hasKey("alph"));
+
+    Dictionary<string, string>().saveSnapshot(path);
+    namesLoaded.loadSnapshot(path);
+    assert(namesLoaded.count() == 0);
+    MappedDictionary<string, string> mappedNone(path);
+    assert(mappedNone.count() == 0 && !mappedNone.hasKey("alpha"));
+
+    // Three int entries of 8 bytes each follow the 32-byte header and the index of 3 offsets
+    Dictionary<int, int> small;
+    small.insert(1, 10);
+    small.insert(2, 20);
+    small.insert(3, 30);
+    ostringstream os;
+    small.saveSnapshot(os);
+    const string valid = os.str();
+    const size_t entries = 32 + 3 * sizeof(uint64_t);
+    assert(valid.size() == entries + 3 * 2 * sizeof(int) && !snapshot_rejected(path, valid));
+
+    assert(snapshot_rejected(path, ""));
+    assert(snapshot_rejected(path, valid.substr(0, 20)));
+    string badMagic = valid;
+    badMagic[0] = 'X';
+    assert(snapshot_rejected(path, badMagic));
+    bool mappedRejected = false;
+    try {
+        MappedDictionary<int, int> mapped(path);
+    }
+    catch (const runtime_error&) {
+        mappedRejected = true;
     }
+    assert(mappedRejected);
+    string badCount = valid;
+    uint64_t count = 1000;
+    memcpy(&badCount[16], &count, sizeof(count));
+    assert(snapshot_rejected(path, badCount));
 
-    Node* root;
-};
+    string duplicate = valid;
+    int key = 2;
+    memcpy(&duplicate[entries], &key, sizeof(key));
+    assert(snapshot_rejected(path, duplicate));
+    string unsorted = valid;
+    key = 5;
+    memcpy(&unsorted[entries], &key, sizeof(key));
+    assert(snapshot_rejected(path, unsorted));
+    assert(snapshot_rejected(path, valid.substr(0, valid.size() - 2)));
+    assert(snapshot_rejected(path, valid + "x"));
 
-template<typename Key, typename Info>
-void drawInsert(Dictionary<Key, Info>& d, const Key& k, const Info& i) {
-    cout << "Added '" << k << "'" << endl;
-    d.insert(k, i);
-    d.print(cout);
+    std::remove(path.c_str());
 }
 
-void draw_tree() {
-    // See if our tree is self-balancing by visualizing
-    Dictionary<int, int> coutTree;
-    drawInsert(coutTree, 12, 0);
-    drawInsert(coutTree, 8, 0);
-    drawInsert(coutTree, 11, 0);
-    drawInsert(coutTree, 4, 0);
-    drawInsert(coutTree, 10, 0);
-    drawInsert(coutTree, 18, 0);
-    drawInsert(coutTree, 17, 0);
-    drawInsert(coutTree, 5, 0);
-}
+int main(int argc, char** argv) {
+    // Lab3 --bench-freeze [max keys]: lookup benchmark from 10^4 keys up to 10^7 (or the given maximum)
+    if (argc > 1 && strcmp(argv[1], "--bench-freeze") == 0) {
+        bench_freeze(argc > 2 ? (size_t)stoull(argv[2]) : (size_t)10000000);
+        return 0;
+    }
+    // Lab3 --bench-concurrent: scaling of ConcurrentDictionary from 1 to 64 threads
+    if (argc > 1 && strcmp(argv[1], "--bench-concurrent") == 0) {
+        bench_concurrent();
+        return 0;
+    }
+    // Lab3 --bench-hash: Dictionary against HashDictionary with string keys
+    if (argc > 1 && strcmp(argv[1], "--bench-hash") == 0) {
+        bench_hash();
+        return 0;
+    }
+    // Lab3 --bench-compare: comparisons per lookup with two-way and three-way comparators
+    if (argc > 1 && strcmp(argv[1], "--bench-compare") == 0) {
+        bench_compare();
+        return 0;
+    }
+    // Lab3 --bench-copy [keys]: parallel copy and teardown of a tree of 10^7 (or the given number of) keys
+    if (argc > 1 && strcmp(argv[1], "--bench-copy") == 0) {
+        bench_copy(argc > 2 ? (size_t)stoull(argv[2]) : (size_t)10000000);
+        return 0;
+    }
+    // Lab3 --bench-small: building and searching tiny dictionaries with and without the inline mode
+    if (argc > 1 && strcmp(argv[1], "--bench-small") == 0) {
+        bench_small();
+        return 0;
+    }
+    // Lab3 --bench-balance: AVL, red-black and treap policies under different operation mixes
+    if (argc > 1 && strcmp(argv[1], "--bench-balance") == 0) {
+        bench_balance();
+        return 0;
+    }
 
-int main() {
     draw_tree();
 
     Dictionary<string, int> test;
@@ -384,6 +716,326 @@ int main() {
     assert(test2.tryGetInfo("thirty nine", value));
     assert(value == 39);
 
+    vector<pair<int, int>> sorted;
+    for (int j = 0; j < 100; ++j) {
+        sorted.emplace_back(j, j * j);
+    }
+    Dictionary<int, int> bulk(sortedInput, sorted.begin(), sorted.end());
+    assert(bulk.count() == 100);
+    assert(bulk.tryGetInfo(42, value));
+    assert(value == 42 * 42);
+
+    reverse(sorted.begin(), sorted.end());
+    Dictionary<int, int> unsorted(sorted.begin(), sorted.end());
+    assert(unsorted.count() == 100);
+    assert(unsorted.hasKey(0) && unsorted.hasKey(99));
+
+    int expected = 10;
+    for (auto it = bulk.lowerBound(10); it != bulk.upperBound(20); ++it) {
+        assert(it.getKey() == expected++);
+    }
+    assert(expected == 21);
+    int visited = 0;
+    bulk.forEachInRange(90, 200, [&](const int&, int&) { ++visited; });
+    assert(visited == 10);
+    bulk.forEachInRange(0, 9, [](const int& k, int& v) { v = -k; });
+    assert(bulk.getInfo(9) == -9 && bulk.getInfo(10) == 100);
+    // Keys reach the callback const, so it cannot rewrite them out of order
+    auto rewritesKeys = [](int& k, int&) { k = 100 - k; };
+    auto readsKeys = [](const int&, const int&) { };
+    static_assert(!AcceptsRangeCallback<Dictionary<int, int>, decltype(rewritesKeys)>::value, "keys are mutable");
+    static_assert(AcceptsRangeCallback<Dictionary<int, int>, decltype(readsKeys)>::value, "const callback rejected");
+    static_assert(AcceptsRangeCallback<const Dictionary<int, int>, decltype(readsKeys)>::value, "const callback rejected");
+
+    FrozenDictionary<int, int> frozen = bulk.freeze();
+    assert(frozen.count() == 100);
+    assert(frozen.tryGetInfo(42, value));
+    assert(value == 42 * 42);
+    assert(!frozen.hasKey(100));
+    for (int key = -1; key <= 100; ++key) {
+        assert(frozen.hasKey(key) == bulk.hasKey(key));
+    }
+    FrozenDictionary<int, int> frozenEmpty = Dictionary<int, int>().freeze();
+    assert(frozenEmpty.count() == 0 && !frozenEmpty.hasKey(0));
+    Dictionary<string, int> spelled;
+    for (int j = 0; j < 1000; ++j) {
+        spelled.insert(to_string(j * 7), j);
+    }
+    FrozenDictionary<string, int> frozenWords = spelled.freeze();
+    assert(frozenWords.getInfo("6993") == 999 && !frozenWords.hasKey("6994") && frozenWords.hasKey("0"));
+
+    assert(bulk.rank(42) == 42);
+    assert(bulk.select(42).getKey() == 42);
+    assert(!bulk.select(100).isValid());
+    assert(bulk.countInRange(10, 19) == 10);
+
+    Dictionary<string, int> counters;
+    ++counters.getOrInsert("hits", []() { return 0; });
+    ++counters.getOrInsert("hits", []() { return 0; });
+    assert(counters.getInfo("hits") == 2);
+    assert(!counters.tryEmplace("hits", 7).second);
+    assert(counters.tryEmplace("misses", 7).second);
+    assert(!counters.insertOrAssign("misses", 8));
+    assert(*counters.find("misses") == 8);
+    assert(counters.find("none") == nullptr);
+
+    Dictionary<int, int> evens;
+    Dictionary<int, int> threes;
+    for (int j = 0; j < 30; ++j) {
+        evens.insert(2 * j, 0);
+        threes.insert(3 * j, 1);
+    }
+    Dictionary<int, int> both = evens;
+    both.intersect(threes);
+    assert(both.count() == 10 && both.getInfo(6) == 0);
+    evens.difference(threes);
+    assert(evens.count() == 20 && !evens.hasKey(6));
+    evens.unionWith(threes, ConflictPolicy::KeepTheirs);
+    assert(evens.count() == 50 && evens.getInfo(6) == 1);
+
+    // A resolver with state runs on the calling thread only, even for inputs large enough for ParallelJoin
+    vector<pair<int, int>> oddEntries;
+    vector<pair<int, int>> tripleEntries;
+    for (int j = 0; j < 1 << 17; ++j) {
+        oddEntries.emplace_back(2 * j + 1, 1);
+        tripleEntries.emplace_back(3 * j, 2);
+    }
+    Dictionary<int, int> odds(SortedInput(), oddEntries.begin(), oddEntries.end());
+    Dictionary<int, int> triples(SortedInput(), tripleEntries.begin(), tripleEntries.end());
+    int conflicts = 0;
+    odds.unionWith(triples, [&conflicts](int, int ours, int theirs) {
+        ++conflicts;
+        return ours + theirs;
+    });
+    int inBoth = 0;
+    for (const pair<int, int>& entry : tripleEntries) {
+        inBoth += entry.first % 2 == 1 && entry.first < 1 << 18 ? 1 : 0;
+    }
+    assert(conflicts == inBoth && odds.count() == (1 << 18) - inBoth);
+    assert(odds.getInfo(3) == 3 && odds.getInfo(6) == 2 && odds.getInfo(5) == 1);
+
+    ostringstream exported;
+    TreeExport limits;
+    limits.format = TreeFormat::Json;
+    limits.maxDepth = 1;
+    evens.exportTree(exported, limits);
+    assert(exported.str().find("\"id\": 2,") != string::npos && exported.str().find("\"id\": 3,") == string::npos);
+    assert(exported.str().find("\"truncated\": true") != string::npos);
+
+    // Text and DOT exports, whole and cut off by depth or node count
+    Dictionary<int, int> perfect;
+    for (int key : { 4, 2, 6, 1, 3, 5, 7 }) {
+        perfect.insert(key, key);
+    }
+    ostringstream text;
+    perfect.exportTree(text, TreeExport());
+    assert(text.str() == "0: 4 [h=3 b=0]\n1: 2 [h=2 b=0] 6 [h=2 b=0]\n2: 1 [h=1 b=0] 3 [h=1 b=0] 5 [h=1 b=0] 7 [h=1 b=0]\n");
+    TreeExport shallow;
+    shallow.maxDepth = 1;
+    text.str("");
+    perfect.exportTree(text, shallow);
+    assert(text.str() == "0: 4 [h=3 b=0]\n1: 2 [h=2 b=0]... 6 [h=2 b=0]...\n(3 of 7 nodes)\n");
+    TreeExport dot;
+    dot.format = TreeFormat::Dot;
+    dot.maxNodes = 2;
+    text.str("");
+    perfect.exportTree(text, dot);
+    assert(text.str() == "digraph Dictionary {\n    node [shape=box];\n"
+                         "    n0 [label=\"4\\nh=3 b=0\" style=dashed];\n"
+                         "    n1 [label=\"2\\nh=2 b=0\" style=dashed];\n"
+                         "    n0 -> n1 [label=L];\n}\n");
+
+    // DOT labels escape quotes and backslashes the Graphviz way, JSON keeps \u escapes
+    Dictionary<string, int> quoted;
+    quoted.insert("say \"hi\"", 1);
+    quoted.insert("a\\b", 2);
+    quoted.insert("two\nlines\t!", 3);
+    dot.maxNodes = numeric_limits<size_t>::max();
+    text.str("");
+    quoted.exportTree(text, dot);
+    assert(text.str().find("n0 [label=\"say \\\"hi\\\"\\nh=2 b=0\"];") != string::npos);
+    assert(text.str().find("n1 [label=\"a\\\\b\\nh=1 b=0\"];") != string::npos);
+    assert(text.str().find("n2 [label=\"two\\nlines !\\nh=1 b=0\"];") != string::npos);
+    assert(text.str().find("\\u00") == string::npos);
+    TreeExport asJson;
+    asJson.format = TreeFormat::Json;
+    text.str("");
+    quoted.exportTree(text, asJson);
+    assert(text.str().find("\"key\": \"two\\u000alines\\u0009!\"") != string::npos);
+
+    // The inline array of the small mode has no heights or balances to show
+    Dictionary<int, int, less<>, AvlBalance, 4> few;
+    for (int key : { 1, 2, 3 }) {
+        few.insert(key, key);
+    }
+    text.str("");
+    few.exportTree(text, TreeExport());
+    assert(text.str() == "0: 1 [inline]\n1: 2 [inline]\n2: 3 [inline]\n");
+    text.str("");
+    few.exportTree(text, asJson);
+    assert(text.str().find("\"inline\": true") != string::npos && text.str().find("\"balance\"") == string::npos);
+
+    Dictionary<int, int, less<>, RedBlackBalance> redBlack;
+    Dictionary<int, int, less<>, TreapBalance> treap;
+    for (int j = 0; j < 1000; ++j) {
+        redBlack.insert(j, j);
+        treap.insert(j, j);
+    }
+    for (int j = 0; j < 1000; j += 2) {
+        redBlack.remove(j);
+        treap.remove(j);
+    }
+    assert(redBlack.count() == 500 && redBlack.hasKey(999) && !redBlack.hasKey(998));
+    assert(treap.count() == 500 && treap.rank(501) == 250);
+    assert(redBlack.height() <= 2 * 9 && redBlack.rotations() > 0);
+
+    HashDictionary<string, int> hashed;
+    for (int j = 0; j < 1000; ++j) {
+        hashed.insert(to_string(j), j);
+    }
+    hashed.remove("500");
+    assert(hashed.count() == 999 && !hashed.hasKey("500"));
+    assert(hashed.getInfo("999") == 999);
+    assert(hashed.tryGetInfo("42", value) && value == 42);
+    HashDictionary<string, int> hashedCopy = hashed;
+    hashed.clear();
+    assert(hashed.count() == 0 && hashedCopy.count() == 999 && hashedCopy.hasKey("0"));
+
+    Dictionary<string, int> words;
+    words.insert("alpha", 1);
+    words.insert("beta", 2);
+    assert(words.hasKey(string_view("alpha")));
+    assert(words.tryGetInfo("beta", value));
+    assert(value == 2);
+    words.remove(string_view("beta"));
+    assert(!words.hasKey("beta"));
+
+    ConcurrentDictionary<int, int> shared(8);
+    shared.insertBatch(sorted);
+    assert(shared.count() == 100);
+    assert(!shared.tryInsert(7, 0));
+    shared.remove(7);
+    assert(shared.tryInsert(7, 49));
+    assert(shared.getInfo(7) == 49);
+
+    PersistentDictionary<string, int> v1;
+    v1.insert("one", 1);
+    v1.insert("two", 2);
+    PersistentDictionary<string, int> v2 = v1;
+    v2.remove("one");
+    v2.insert("three", 3);
+    assert(v1.hasKey("one") && !v1.hasKey("three") && v1.count() == 2);
+    assert(!v2.hasKey("one") && v2.getInfo("three") == 3 && v2.count() == 2);
+
+    // A copy made on a task pool is the same tree as a serial copy
+    Dictionary<int, int, less<>, RedBlackBalance> large;
+    for (int j = 0; j < 100000; ++j) {
+        large.insert(j * 7919 % 100003, j);
+    }
+    TaskPool pool(3);
+    Dictionary<int, int, less<>, RedBlackBalance> serialCopy = large;
+    Dictionary<int, int, less<>, RedBlackBalance> parallelCopy(large, pool);
+    TreeExport json;
+    json.format = TreeFormat::Json;
+    ostringstream serialTree;
+    ostringstream parallelTree;
+    serialCopy.exportTree(serialTree, json);
+    parallelCopy.exportTree(parallelTree, json);
+    assert(serialTree.str() == parallelTree.str());
+    parallelCopy.clear(pool);
+    assert(parallelCopy.count() == 0 && large.count() == 100000);
+
+    Dictionary<int, int> counted;
+    for (int j = 0; j < 100; ++j) {
+        counted.insert(j, j);
+    }
+    counted.remove(50);
+    ContainerStats stats = counted.stats();
+#ifdef EADS_STATS
+    assert(stats.allocations == 100 && stats.frees == 1 && stats.rotations == counted.rotations());
+    assert(stats.comparisons > 0 && stats.nodeVisits >= stats.comparisons);
+    counted.clear();
+    assert(counted.stats().frees == 100);
+    counted.resetStats();
+    assert(counted.stats().comparisons == 0 && counted.stats().allocations == 0);
+#else
+    // Disabled counters take no space and count nothing
+    assert(stats.comparisons == 0 && stats.allocations == 0);
+    static_assert(is_empty<StatsCounters>::value, "Disabled counters must be an empty member");
+#endif
+
+#ifdef EADS_LATENCY
+    resetLatency();
+    static size_t spans = 0;
+    setTraceHook([](const TraceSpan&) { ++spans; });
+    Dictionary<int, int> timed;
+    for (int j = 0; j < 100; ++j) {
+        timed.insert(j, j);
+    }
+    assert(timed.hasKey(42));
+    setTraceHook(nullptr);
+    assert(spans == 101);
+    bool sawInsert = false;
+    for (const LatencySummary& s : latencySummaries()) {
+        assert(s.p50 <= s.p99 && s.p99 <= s.p999 && s.p999 <= s.max);
+        if (s.operation == "Dictionary::insert") {
+            sawInsert = s.count == 100;
+        }
+    }
+    assert(sawInsert);
+    resetLatency();
+    assert(latencySummaries().empty());
+#else
+    assert(latencySummaries().empty());
+#endif
+
+    test_snapshots();
+    test_set_algorithms<AvlBalance>();
+    test_set_algorithms<RedBlackBalance>();
+    test_set_algorithms<TreapBalance>();
+    test_concurrent_dictionary();
+    test_published_dictionary();
+
+    // Up to four entries stay in the inline array, the fifth moves them to the tree
+    Dictionary<string, int, less<>, RedBlackBalance, 4> tiny;
+    for (int j = 4; j >= 0; --j) {
+        tiny.insert(to_string(j), j);
+        assert(tiny.count() == 5 - j && tiny.getInfo(to_string(j)) == j);
+    }
+    tiny.remove("2");
+    assert(!tiny.hasKey("2") && tiny.rank(string("3")) == 2 && (--tiny.end()).getKey() == "4");
+    Dictionary<string, int, less<>, RedBlackBalance, 4> tinyCopy(tiny);
+    tiny.clear();
+    tiny.insert("b", 2);
+    tiny.insert("a", 1);
+    assert(tiny.begin().getKey() == "a" && tiny.tryEmplace("a", 5).second == false);
+    tiny.remove("a");
+    tiny.merge(tinyCopy);
+    string merged;
+    for (auto it = tiny.begin(); it != tiny.end(); ++it) {
+        merged += it.getKey();
+    }
+    assert(merged == "0134b" && tinyCopy.count() == 4);
+
+    // In the small mode an insert shifts the entries, so a reference follows its slot
+    Dictionary<int, int, less<>, AvlBalance, 4> shifting;
+    shifting.insert(2, 2);
+    int& slotted = shifting.getInfo(2);
+    shifting.insert(1, 1);
+    assert(slotted == 1 && shifting.getInfo(2) == 2);
+    // while in the tree it stays with its entry
+    Dictionary<int, int> linked;
+    linked.insert(2, 2);
+    int& held = linked.getInfo(2);
+    linked.insert(1, 1);
+    assert(held == 2 && &held == &linked.getInfo(2));
+
+    // Leaving the small mode moves the entries, so a move-only Info is fine
+    Dictionary<string, unique_ptr<int>, less<>, AvlBalance, 4> owning;
+    for (int j = 0; j < 6; ++j) {
+        assert(owning.tryEmplace(to_string(j), make_unique<int>(j)).second);
+    }
+    assert(owning.count() == 6 && *owning.getInfo("0") == 0 && *owning.getInfo("5") == 5);
+
     return 0;
 }
-
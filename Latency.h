@@ -0,0 +1,262 @@
+#ifndef EADS_LATENCY_H
+#define EADS_LATENCY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace eads {
+
+// Latency percentiles of one container operation, in nanoseconds
+struct LatencySummary {
+    std::string operation;    // e.g. "Ring::insert"
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+// One timed call, passed to the trace hook when it returns (or throws)
+struct TraceSpan {
+    const char* operation;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::nanoseconds duration;
+};
+
+using TraceHook = void (*)(const TraceSpan& span);
+
+#ifdef EADS_LATENCY
+
+// Counts of latencies in log-linear buckets (as HdrHistogram does): exact below
+// 32 ns, then 32 buckets per power of two, so a percentile is at most about 3%
+// above the true value. Safe to record into from any number of threads.
+class LatencyHistogram {
+public:
+    static constexpr int subBits = 5;
+    static constexpr size_t bucketCount = (64 - subBits + 1) << subBits;
+
+    LatencyHistogram() : total(0), largest(0) {
+        for (std::atomic<uint64_t>& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t ns) {
+        buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (ns > seen && !largest.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return largest.load(std::memory_order_relaxed);
+    }
+
+    // The smallest latency which at least fraction q of the recorded calls did not exceed
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        double exact = q * (double)n;
+        uint64_t rank = (uint64_t)exact;
+        rank += (double)rank < exact ? 1 : 0;
+        rank = rank < 1 ? 1 : (rank > n ? n : rank);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucketCount; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t high = highestOf(i);
+                return high < max() ? high : max();
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (std::atomic<uint64_t>& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < (1u << subBits)) {
+            return (size_t)ns;
+        }
+        int shift = highestBit(ns) - subBits;
+        return ((size_t)shift << subBits) + (size_t)(ns >> shift);
+    }
+
+    static int highestBit(uint64_t x) {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(x);
+#else
+        int bit = 0;
+        while (x >>= 1) {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    // The largest value which falls into bucket i
+    static uint64_t highestOf(size_t i) {
+        if (i < (1u << subBits)) {
+            return i;
+        }
+        int shift = (int)(i >> subBits) - 1;
+        uint64_t mantissa = (i & ((1u << subBits) - 1)) + (1u << subBits);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> buckets[bucketCount];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+};
+
+// All histograms of the process by operation name; they live until exit
+class LatencyRegistry {
+public:
+    // Never destroyed, so containers may still be timed by destructors running at exit
+    static LatencyRegistry& instance() {
+        static LatencyRegistry* registry = new LatencyRegistry();
+        return *registry;
+    }
+
+    LatencyHistogram& histogram(const char* operation) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::unique_ptr<LatencyHistogram>& h = histograms[operation];
+        if (h == nullptr) {
+            h.reset(new LatencyHistogram());
+        }
+        return *h;
+    }
+
+    std::vector<LatencySummary> summaries() {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<LatencySummary> result;
+        for (auto& entry : histograms) {
+            const LatencyHistogram& h = *entry.second;
+            if (h.count() == 0) {
+                continue;
+            }
+            LatencySummary s;
+            s.operation = entry.first;
+            s.count = h.count();
+            s.p50 = h.percentile(0.5);
+            s.p99 = h.percentile(0.99);
+            s.p999 = h.percentile(0.999);
+            s.max = h.max();
+            result.push_back(s);
+        }
+        return result;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& entry : histograms) {
+            entry.second->reset();
+        }
+    }
+
+    TraceHook traceHook() const {
+        return hook.load(std::memory_order_acquire);
+    }
+
+    void setTraceHook(TraceHook h) {
+        hook.store(h, std::memory_order_release);
+    }
+
+private:
+    LatencyRegistry() : hook(nullptr) { }
+
+    std::atomic<TraceHook> hook;
+    std::mutex lock;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+};
+
+// Times the enclosing scope into a histogram and reports it to the trace hook
+class OperationTimer {
+public:
+    OperationTimer(LatencyHistogram& h, const char* operation)
+        : histogram(h), name(operation), start(std::chrono::steady_clock::now()) { }
+
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator =(const OperationTimer&) = delete;
+
+    ~OperationTimer() {
+        std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start;
+        histogram.record((uint64_t)duration.count());
+        TraceHook hook = LatencyRegistry::instance().traceHook();
+        if (hook != nullptr) {
+            hook(TraceSpan { name, start, duration });
+        }
+    }
+
+private:
+    LatencyHistogram& histogram;
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Put first in a container method to time every call of it under the given name.
+// The histogram is looked up once per instantiation of the method.
+#define EADS_TIMED(operation) \
+    static ::eads::LatencyHistogram& eadsHistogram = ::eads::LatencyRegistry::instance().histogram(operation); \
+    ::eads::OperationTimer eadsTimer(eadsHistogram, operation)
+
+// Percentiles of every operation called since start or the last resetLatency()
+inline std::vector<LatencySummary> latencySummaries() {
+    return LatencyRegistry::instance().summaries();
+}
+
+inline void resetLatency() {
+    LatencyRegistry::instance().reset();
+}
+
+// Called with every timed call as it returns, from the calling thread; nullptr turns it off
+inline void setTraceHook(TraceHook hook) {
+    LatencyRegistry::instance().setTraceHook(hook);
+}
+
+#else
+
+// Without EADS_LATENCY nothing is timed, there are no summaries and the hook is never called
+#define EADS_TIMED(operation) ((void)0)
+
+inline std::vector<LatencySummary> latencySummaries() {
+    return std::vector<LatencySummary>();
+}
+
+inline void resetLatency() { }
+
+inline void setTraceHook(TraceHook) { }
+
+#endif
+
+// Writes one line per operation: name, calls, p50, p99, p99.9 and max in nanoseconds
+inline void dumpLatency(std::ostream& os) {
+    os << "operation\tcount\tp50 ns\tp99 ns\tp999 ns\tmax ns\n";
+    for (const LatencySummary& s : latencySummaries()) {
+        os << s.operation << "\t" << s.count << "\t" << s.p50 << "\t" << s.p99 << "\t" << s.p999 << "\t" << s.max << "\n";
+    }
+}
+
+}
+
+#endif
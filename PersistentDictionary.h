@@ -0,0 +1,312 @@
+#ifndef EADS_PERSISTENT_DICTIONARY_H
+#define EADS_PERSISTENT_DICTIONARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include "KeyTraits.h"
+
+namespace eads {
+
+// An immutable-node AVL tree. Copies share all nodes and cost O(1); insert and
+// remove copy only the O(log n) nodes on the search path (path copying), so
+// older copies keep seeing their own version. Nodes are reference counted
+// atomically, which lets snapshots be read and dropped on any thread.
+template<typename Key, typename Info, typename Compare = std::less<>>
+class PersistentDictionary {
+public:
+    PersistentDictionary() : root(nullptr), count_(0), comp() {
+
+    }
+
+    PersistentDictionary(const PersistentDictionary& copy)
+        : root(retain(copy.root)), count_(copy.count_), comp(copy.comp)
+    {
+    }
+
+    PersistentDictionary(PersistentDictionary&& move) noexcept
+        : root(move.root), count_(move.count_), comp(move.comp)
+    {
+        move.root = nullptr;
+        move.count_ = 0;
+    }
+
+    ~PersistentDictionary() {
+        release(root);
+    }
+
+    PersistentDictionary& operator =(PersistentDictionary that) {
+        std::swap(root, that.root);
+        std::swap(count_, that.count_);
+        std::swap(comp, that.comp);
+        return *this;
+    }
+
+    int count() const {
+        return count_;
+    }
+
+    void clear() {
+        release(root);
+        root = nullptr;
+        count_ = 0;
+    }
+
+    void insert(const Key& k, const Info& i) {
+        const Node* updated = insert(root, k, i);
+        release(root);
+        root = updated;
+        ++count_;
+    }
+
+    template<typename K>
+    void remove(const K& k) {
+        const LookupKey<K>& key = k;
+        if (findNode(key) != nullptr) {
+            const Node* updated = remove(root, key);
+            release(root);
+            root = updated;
+            --count_;
+        }
+    }
+
+    template<typename K>
+    bool hasKey(const K& k) const {
+        return findNode(k) != nullptr;
+    }
+
+    template<typename K>
+    bool tryGetInfo(const K& k, Info& i) const {
+        const Node* n = findNode(k);
+        if (n != nullptr) {
+            i = n->info;
+            return true;
+        }
+        return false;
+    }
+
+    // The reference stays valid for as long as this version is alive
+    template<typename K>
+    const Info& getInfo(const K& k) const {
+        const Node* n = findNode(k);
+        if (n == nullptr) {
+            throw std::runtime_error("The given key is not present");
+        }
+        return n->info;
+    }
+
+    // Calls fn(key, info) for every entry in key order
+    template<typename Fn>
+    void forEach(Fn fn) const {
+        forEach(root, fn);
+    }
+
+private:
+    template<typename K>
+    using LookupKey = typename std::conditional<IsTransparent<Compare>::value, K, Key>::type;
+
+    // Never modified once it is reachable from a published version
+    struct Node {
+        Key key;
+        Info info;
+        const Node* nodeL;
+        const Node* nodeR;
+        int height;
+        mutable std::atomic<unsigned> refs;
+
+        Node(const Key& k, const Info& i, const Node* l, const Node* r)
+            : key(k), info(i), nodeL(l), nodeR(r), height(std::max(heightOf(l), heightOf(r)) + 1), refs(1)
+        {
+        }
+    };
+
+    static int heightOf(const Node* n) {
+        return n == nullptr ? 0 : n->height;
+    }
+
+    static const Node* retain(const Node* n) {
+        if (n != nullptr) {
+            n->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    static void release(const Node* n) {
+        if (n != nullptr && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(n->nodeL);
+            release(n->nodeR);
+            delete n;
+        }
+    }
+
+    // Takes over one reference to each of l and r
+    static const Node* make(const Key& k, const Info& i, const Node* l, const Node* r) {
+        try {
+            return new Node(k, i, l, r);
+        }
+        catch (...) {
+            release(l);
+            release(r);
+            throw;
+        }
+    }
+
+    // Like make(), but restores the AVL invariant with at most two rotations
+    static const Node* balance(const Key& k, const Info& i, const Node* l, const Node* r) {
+        int hl = heightOf(l);
+        int hr = heightOf(r);
+        if (hl > hr + 1) {
+            const Node* result;
+            if (heightOf(l->nodeL) >= heightOf(l->nodeR)) {
+                const Node* right = make(k, i, retain(l->nodeR), r);
+                result = make(l->key, l->info, retain(l->nodeL), right);
+            }
+            else {
+                const Node* lr = l->nodeR;
+                const Node* left = make(l->key, l->info, retain(l->nodeL), retain(lr->nodeL));
+                const Node* right = make(k, i, retain(lr->nodeR), r);
+                result = make(lr->key, lr->info, left, right);
+            }
+            release(l);
+            return result;
+        }
+        if (hr > hl + 1) {
+            const Node* result;
+            if (heightOf(r->nodeR) >= heightOf(r->nodeL)) {
+                const Node* left = make(k, i, l, retain(r->nodeL));
+                result = make(r->key, r->info, left, retain(r->nodeR));
+            }
+            else {
+                const Node* rl = r->nodeL;
+                const Node* left = make(k, i, l, retain(rl->nodeL));
+                const Node* right = make(r->key, r->info, retain(rl->nodeR), retain(r->nodeR));
+                result = make(rl->key, rl->info, left, right);
+            }
+            release(r);
+            return result;
+        }
+        return make(k, i, l, r);
+    }
+
+    // Returns a new reference to the updated version of subtree n
+    const Node* insert(const Node* n, const Key& k, const Info& i) {
+        if (n == nullptr) {
+            return make(k, i, nullptr, nullptr);
+        }
+        if (comp(k, n->key)) {
+            const Node* l = insert(n->nodeL, k, i);
+            return balance(n->key, n->info, l, retain(n->nodeR));
+        }
+        if (comp(n->key, k)) {
+            const Node* r = insert(n->nodeR, k, i);
+            return balance(n->key, n->info, retain(n->nodeL), r);
+        }
+        throw std::runtime_error("Duplicate keys are forbidden");
+    }
+
+    // Expects the key to be present
+    template<typename K>
+    const Node* remove(const Node* n, const K& k) {
+        if (comp(k, n->key)) {
+            const Node* l = remove(n->nodeL, k);
+            return balance(n->key, n->info, l, retain(n->nodeR));
+        }
+        if (comp(n->key, k)) {
+            const Node* r = remove(n->nodeR, k);
+            return balance(n->key, n->info, retain(n->nodeL), r);
+        }
+        if (n->nodeL == nullptr) {
+            return retain(n->nodeR);
+        }
+        if (n->nodeR == nullptr) {
+            return retain(n->nodeL);
+        }
+        const Node* next = n->nodeR;
+        while (next->nodeL != nullptr) {
+            next = next->nodeL;
+        }
+        const Node* r = removeMin(n->nodeR);
+        return balance(next->key, next->info, retain(n->nodeL), r);
+    }
+
+    static const Node* removeMin(const Node* n) {
+        if (n->nodeL == nullptr) {
+            return retain(n->nodeR);
+        }
+        const Node* l = removeMin(n->nodeL);
+        return balance(n->key, n->info, l, retain(n->nodeR));
+    }
+
+    template<typename K>
+    const Node* findNode(const K& key) const {
+        const LookupKey<K>& k = key;
+        const Node* n = root;
+        while (n != nullptr) {
+            if (comp(n->key, k)) {
+                n = n->nodeR;
+            }
+            else if (comp(k, n->key)) {
+                n = n->nodeL;
+            }
+            else {
+                break;
+            }
+        }
+        return n;
+    }
+
+    template<typename Fn>
+    static void forEach(const Node* n, Fn& fn) {
+        if (n != nullptr) {
+            forEach(n->nodeL, fn);
+            fn(n->key, n->info);
+            forEach(n->nodeR, fn);
+        }
+    }
+
+    const Node* root;
+    int count_;
+    Compare comp;
+};
+
+// Publishes versions of a PersistentDictionary to concurrent readers.
+// snapshot() and publish() only copy a root pointer under the lock, so readers
+// keep working on their snapshot while a writer prepares the next version.
+template<typename Key, typename Info, typename Compare = std::less<>>
+class PublishedDictionary {
+public:
+    PersistentDictionary<Key, Info, Compare> snapshot() const {
+        std::lock_guard<std::mutex> lock(current);
+        return version;
+    }
+
+    void publish(PersistentDictionary<Key, Info, Compare> next) {
+        {
+            std::lock_guard<std::mutex> lock(current);
+            std::swap(version, next);
+        }
+        // The replaced version is released here, outside of the lock
+    }
+
+    // Applies fn to a copy of the latest version and publishes the result;
+    // concurrent update() calls are serialized, readers are not blocked
+    template<typename Fn>
+    void update(Fn fn) {
+        std::lock_guard<std::mutex> lock(writer);
+        PersistentDictionary<Key, Info, Compare> next = snapshot();
+        fn(next);
+        publish(std::move(next));
+    }
+
+private:
+    mutable std::mutex current;
+    std::mutex writer;
+    PersistentDictionary<Key, Info, Compare> version;
+};
+
+}
+
+#endif
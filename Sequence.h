@@ -0,0 +1,560 @@
+#ifndef EADS_SEQUENCE_H
+#define EADS_SEQUENCE_H
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include "InlineStorage.h"
+#include "Latency.h"
+#include "Stats.h"
+
+namespace eads {
+
+// A single-linked list. With N > 0 up to N elements are kept in an array inside
+// the sequence, still linked through Next, and found by scanning the array;
+// the first insert beyond N moves them to heap nodes. In that small mode an
+// insert or removal shifts elements between the slots, so a Node* and the
+// TInfo& from its GetInfo stay valid only until then; afterwards they may
+// refer to another element.
+template<typename TKey, typename TInfo, size_t N = 0>
+class Sequence {
+public:
+    
+    // A linked-list node
+    class Node {
+        friend class Sequence;
+
+    public:
+        // Simple constructor
+        Node(const TKey& key, const TInfo& info, Node* next = nullptr) : Key(key), Info(info), Next(next) { }
+
+        // Constructor taking over the key and info
+        Node(TKey&& key, TInfo&& info, Node* next = nullptr) : Key(std::move(key)), Info(std::move(info)), Next(next) { }
+
+        // Copy constructor
+        Node(const Node& copy) : Key(copy.Key), Info(copy.Info), Next(copy.Next) { }
+        
+        // Move constructor
+        Node(Node&& move) : Key(), Info(), Next(nullptr) {
+            std::swap(Key, move.Key);
+            std::swap(Info, move.Info);
+            std::swap(Next, move.Next);
+        }
+
+        // Overloading assignment operator
+        Node& operator= (const Node& assign) {
+            if (this != &assign) {
+                Key = assign.Key;
+                Info = assign.Info;
+                Next = assign.Next;
+            }
+            return *this;
+        }
+
+        TKey GetKey(void) const {
+            return Key;
+        }
+
+        TInfo& GetInfo(void) const {
+            return Info;
+        }
+
+        Node* GetNext(void) const {
+            return Next;
+        }
+
+    private:
+        ~Node(void) {
+            Next = nullptr;
+        }
+
+        TKey Key;
+        TInfo Info;
+
+        // Single-linked list
+        Node* Next;
+    };
+
+    // Default constructor
+    Sequence(void) : Head(nullptr) {
+
+    }
+
+    // Copy constructor
+    Sequence(const Sequence& copy) : Head(nullptr) {
+        CopyFrom(copy, 0, copy.Count());
+    }
+
+    // Move constructor; inline elements are copied over and the source is cleared
+    Sequence(Sequence&& move) noexcept(N == 0) : Head(nullptr) {
+        if (move.IsSmall()) {
+            CopyFrom(move, 0, move.Count());
+            move.Clear();
+        }
+        else {
+            std::swap(Head, move.Head);
+        }
+    }
+
+    // Destructor
+    ~Sequence(void) {
+        Clear();
+    }
+
+    // Prints this sequence
+    void Print(void) const {
+        if (Head == nullptr) {
+            std::cout << "[Empty]" << std::endl;
+        } else {
+            std::cout << "[" << Count() << " Elements]" << std::endl;
+            Node* i = Head;
+            while (i != nullptr) {
+                std::cout << "[" << i->Key << ", " << i->Info << "]" << std::endl;
+                i = i->Next;
+            }
+        }
+    }
+
+    // Overloading assignment operator
+    Sequence& operator= (const Sequence& assign) {
+        if (this != &assign) {
+            Clear();
+            CopyFrom(assign, 0, assign.Count());
+        }
+        return *this;
+    }
+
+    Sequence operator+(const Sequence& other) const {
+        Sequence result;
+        result.CopyFrom(*this, 0, Count());
+        result.CopyFrom(other, 0, other.Count());
+        return result;
+    }
+
+    Sequence& operator+=(const Sequence& other) {
+        CopyFrom(other, 0, other.Count());
+        return *this;
+    }
+
+    // Operation counts since construction or ResetStats(), all zero unless built with EADS_STATS
+    ContainerStats Stats(void) const {
+        return counters.get();
+    }
+
+    void ResetStats(void) {
+        counters.reset();
+    }
+
+    // Gets the first element of the sequence
+    Node* GetFirst(void) {
+        return Head;
+    }
+
+    // Returns the first element with the given key
+    Node* FindFirst(const TKey& key) {
+        EADS_TIMED("Sequence::FindFirst");
+        if (IsSmall()) {
+            size_t index = FindSmall(key);
+            return index < slots.size() ? slots.at(index) : nullptr;
+        }
+        if (Head == nullptr) {
+            return nullptr;
+        } else {
+            Node* i = Head;
+            while (i != nullptr) {
+                counters.visited();
+                counters.compared();
+                if (i->Key == key) {
+                    return i;
+                }
+                i = i->Next;
+            }
+            return nullptr;
+        }
+    }
+
+    // Gets the last element of the sequence
+    Node* GetLast(void) {
+        Node* prev;
+        return GetLast(prev);
+    }
+
+    // Gets the last element of the sequence + the previous one
+    Node* GetLast(Node*& prev) {
+        EADS_TIMED("Sequence::GetLast");
+        if (IsSmall() && Head != nullptr) {
+            size_t used = slots.size();
+            prev = used > 1 ? slots.at(used - 2) : nullptr;
+            return slots.at(used - 1);
+        }
+        if (Head == nullptr) {
+            prev = nullptr;
+            return nullptr;
+        } else {
+            prev = nullptr;
+            Node* i = Head;
+            while (i->Next != nullptr) {
+                counters.visited();
+                prev = i;
+                i = i->Next;
+            }
+            return i;
+        }
+    }
+
+    // Node at the provided index
+    Node* At(const size_t index) const {
+        EADS_TIMED("Sequence::At");
+        if (index >= Count()) {
+            throw "Index out of range";
+        }
+        if (IsSmall()) {
+            return const_cast<Node*>(slots.at(index));
+        }
+        Node* i = Head;
+        for (size_t j = 0; j < index; j++) {
+            i = i->Next;
+        }
+        counters.visited(index);
+        return i;
+    }
+
+    // Remove all elements
+    void Clear(void) {
+        EADS_TIMED("Sequence::Clear");
+        if (IsSmall()) {
+            ClearSmall();
+        }
+        else if (Head != nullptr) {
+            Node* i = Head;
+            Node* j = nullptr;
+            while (i != nullptr) {
+                j = i;
+                i = i->Next;
+                delete j;
+                counters.freed();
+            }
+            Head = nullptr;
+        }
+    }
+
+    // Checks whether it is empty
+    bool IsEmpty(void) const {
+        return Head == nullptr;
+    }
+
+    // Removes first element with a given key
+    bool Remove(const TKey& key) {
+        EADS_TIMED("Sequence::Remove");
+        if (IsSmall()) {
+            size_t index = FindSmall(key);
+            if (index == slots.size()) {
+                return false;
+            }
+            EraseSmall(index);
+            return true;
+        }
+        Node* i = Head;
+        Node* j = nullptr;
+        while (i != nullptr) {
+            counters.visited();
+            counters.compared();
+            if (i->Key == key) {
+                if (j == nullptr) {
+                    Head = i->Next;
+                }
+                else {
+                    j->Next = i->Next;
+                }
+                delete i;
+                counters.freed();
+                return true;
+            }
+            j = i;
+            i = i->Next;
+        }
+        return false;
+    }
+
+    // Adds an element with the given key and info to the front
+    void PushFront(const TKey& key, const TInfo& info) {
+        EADS_TIMED("Sequence::PushFront");
+        if (IsSmall() && slots.size() < N) {
+            InsertSmall(slots.size(), key, info);
+            return;
+        }
+        if (IsSmall()) {
+            Spill();
+        }
+        if (Head == nullptr) {
+            Head = new Node(TKey(key), TInfo(info));
+        }
+        else {
+            GetLast()->Next= new Node(TKey(key), TInfo(info));
+        }
+        counters.allocated();
+    }
+
+    // Adds an element with the given key and info to the back
+    void PushBack(const TKey& key, const TInfo& info) {
+        EADS_TIMED("Sequence::PushBack");
+        if (IsSmall() && slots.size() < N) {
+            InsertSmall(0, key, info);
+            return;
+        }
+        if (IsSmall()) {
+            Spill();
+        }
+        Head = new Node(TKey(key), TInfo(info), Head);
+        counters.allocated();
+    }
+
+    // Removes an element in the back
+    bool PopBack(void) {
+        EADS_TIMED("Sequence::PopBack");
+        if (IsSmall() && Head != nullptr) {
+            EraseSmall(0);
+            return true;
+        }
+        if (Head != nullptr) {
+            auto Next = Head->Next;
+            delete Head;
+            counters.freed();
+            Head = Next;
+            return true;
+        }
+        return false;
+    }
+
+    // Removes an element in the front
+    bool PopFront(void) {
+        EADS_TIMED("Sequence::PopFront");
+        if (IsSmall() && Head != nullptr) {
+            EraseSmall(slots.size() - 1);
+            return true;
+        }
+        Node* prev;
+        Node* node = GetLast(prev);
+        if (node != nullptr) {
+            prev->Next = nullptr;
+            delete node;
+            counters.freed();
+            return true;
+        }
+        else {
+            return false;
+        }
+    }
+
+    // How many elements does it have?
+    size_t Count(void) const {
+        EADS_TIMED("Sequence::Count");
+        if (IsSmall()) {
+            return slots.size();
+        }
+        Node* i = Head;
+        size_t j = 0;
+        while (i != nullptr) {
+            ++j;
+            i = i->Next;
+        }
+        counters.visited(j);
+        return j;
+    }
+
+    // Is there at least one element with a given key?
+    bool Contains(const TKey& key) const {
+        EADS_TIMED("Sequence::Contains");
+        if (IsSmall()) {
+            return FindSmall(key) < slots.size();
+        }
+        Node* i = Head;
+        while (i != nullptr) {
+            counters.visited();
+            counters.compared();
+            if (i->Key == key) {
+                return true;
+            }
+            i = i->Next;
+        }
+        return false;
+    }
+
+    Sequence SubSequence(const size_t offset, const size_t count) const {
+        Sequence result;
+        result.CopyFrom(*this, offset, count);
+        return result;
+    }
+
+    // Copy [count] elements from another sequence, starting at [offset]
+    void CopyFrom(const Sequence& from, const size_t offset, const size_t count) {
+        EADS_TIMED("Sequence::CopyFrom");
+        if (from.Count() < offset + count) {
+            throw "The provided sequence doesn't have enough elements to copy";
+        }
+        if (count == 0) {
+            return;
+        }
+        if (IsSmall() && slots.size() + count <= N) {
+            for (size_t k = 0; k < count; k++) {
+                const Node* j = from.At(offset + k);
+                InsertSmall(slots.size(), j->Key, j->Info);
+            }
+            return;
+        }
+        if (IsSmall()) {
+            Spill();
+        }
+
+        Node* j = from.At(offset);
+        Node* i = nullptr;
+
+        if (Head == nullptr) {
+            i = Head = new Node(j->Key, j->Info);
+        }
+        else {
+            i = GetLast()->Next = new Node(j->Key, j->Info);
+        }
+
+        j = j->Next;
+
+        for (size_t k = 1; k < count; k++) {
+            i->Next = new Node(j->Key, j->Info);
+            i = i->Next;
+            j = j->Next;
+        }
+        counters.visited(count);
+        counters.allocated(count);
+    }
+
+private:
+    // Whether the elements are in the inline array: always while empty, and until it overflows
+    bool IsSmall(void) const {
+        return N > 0 && (Head == nullptr || slots.size() > 0);
+    }
+
+    // Index of the first inline element with the key, or the count if there is none
+    size_t FindSmall(const TKey& key) const {
+        size_t used = slots.size();
+        for (size_t i = 0; i < used; i++) {
+            counters.visited();
+            counters.compared();
+            if (slots.at(i)->Key == key) {
+                return i;
+            }
+        }
+        return used;
+    }
+
+    // Links the inline elements in array order
+    void LinkSmall(void) {
+        size_t used = slots.size();
+        for (size_t i = 0; i < used; i++) {
+            slots.at(i)->Next = i + 1 < used ? slots.at(i + 1) : nullptr;
+        }
+        Head = used > 0 ? slots.at(0) : nullptr;
+    }
+
+    // Constructs the element in the next free slot and swaps it down to index
+    void InsertSmall(size_t index, const TKey& key, const TInfo& info) {
+        size_t used = slots.size();
+        new (slots.slot(used)) Node(key, info);
+        slots.resize(used + 1);
+        for (size_t i = used; i > index; i--) {
+            std::swap(slots.at(i)->Key, slots.at(i - 1)->Key);
+            std::swap(slots.at(i)->Info, slots.at(i - 1)->Info);
+        }
+        LinkSmall();
+    }
+
+    // Swaps the element at index up to the last slot and destroys it there
+    void EraseSmall(size_t index) {
+        size_t used = slots.size();
+        for (size_t i = index; i + 1 < used; i++) {
+            std::swap(slots.at(i)->Key, slots.at(i + 1)->Key);
+            std::swap(slots.at(i)->Info, slots.at(i + 1)->Info);
+        }
+        slots.at(used - 1)->~Node();
+        slots.resize(used - 1);
+        LinkSmall();
+    }
+
+    void ClearSmall(void) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots.at(i)->~Node();
+        }
+        slots.resize(0);
+        Head = nullptr;
+    }
+
+    // Moves the inline elements to heap nodes, which are used from now on
+    void Spill(void) {
+        Node* first = nullptr;
+        Node* last = nullptr;
+        try {
+            for (size_t i = 0; i < slots.size(); i++) {
+                Node* node = new Node(std::move(slots.at(i)->Key), std::move(slots.at(i)->Info));
+                (last == nullptr ? first : last->Next) = node;
+                last = node;
+            }
+        }
+        catch (...) {
+            // Moves the elements back, so the sequence is unchanged
+            for (size_t i = 0; first != nullptr; i++) {
+                Node* next = first->Next;
+                slots.at(i)->Key = std::move(first->Key);
+                slots.at(i)->Info = std::move(first->Info);
+                delete first;
+                first = next;
+            }
+            throw;
+        }
+        counters.allocated(slots.size());
+        ClearSmall();
+        Head = first;
+    }
+
+    // Single-linked list
+    Node* Head;
+    [[no_unique_address]] StatsCounters counters;
+    [[no_unique_address]] InlineStorage<Node, N> slots;
+};
+
+
+// Helper method for making sure our arguments fit the no-exception idea
+template<typename Key, typename Info, size_t N>
+void clamp_args_produce(const Sequence<Key, Info, N>& seq1, int& start, int& len, int& limit) {
+    limit = std::max(0, limit);
+    start = std::max(0, start);
+    len = std::max(0, len);
+
+    if (len > 0) {
+        auto maximum = start + len;
+        auto clamped = std::min(maximum, (int)seq1.Count());
+        len = std::min(clamped - start, limit);
+        limit = std::max(0, limit - len);
+    }
+}
+
+
+// Concatenates two sequences
+template<typename Key, typename Info, size_t N>
+Sequence<Key, Info, N> produce(
+        const Sequence<Key, Info, N>& seq1, int start1, int dl1,
+        const Sequence<Key, Info, N>& seq2, int start2, int dl2,
+        int limit)
+{
+    Sequence<Key, Info, N> result;
+
+    clamp_args_produce(seq1, start1, dl1, limit);
+    clamp_args_produce(seq2, start2, dl2, limit);
+
+    result.CopyFrom(seq1, start1, dl1);
+    result.CopyFrom(seq2, start2, dl2);
+
+    return result;
+}
+
+}
+
+#endif
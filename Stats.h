@@ -0,0 +1,92 @@
+#ifndef EADS_STATS_H
+#define EADS_STATS_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace eads {
+
+// What a container has done since construction or its last reset, as returned
+// by stats() (Stats() for Sequence). All zero unless built with EADS_STATS.
+struct ContainerStats {
+    size_t nodeVisits = 0;    // nodes stepped through by searches and traversals
+    size_t comparisons = 0;   // key comparisons
+    size_t rotations = 0;     // tree rotations done while rebalancing
+    size_t allocations = 0;   // nodes (or tables) allocated
+    size_t frees = 0;         // nodes (or tables) freed
+};
+
+#ifdef EADS_STATS
+
+// The counters of one container. Copies start from zero. Counts are added
+// without a locked increment, so concurrent readers may lose a few.
+class StatsCounters {
+public:
+    StatsCounters() : nodeVisits(0), comparisons(0), rotations(0), allocations(0), frees(0) { }
+
+    StatsCounters(const StatsCounters&) : StatsCounters() { }
+
+    StatsCounters& operator =(const StatsCounters&) {
+        return *this;
+    }
+
+    void visited(size_t n = 1) const { add(nodeVisits, n); }
+    void compared(size_t n = 1) const { add(comparisons, n); }
+    void rotated() const { add(rotations, 1); }
+    void allocated(size_t n = 1) const { add(allocations, n); }
+    void freed(size_t n = 1) const { add(frees, n); }
+
+    ContainerStats get() const {
+        ContainerStats result;
+        result.nodeVisits = nodeVisits.load(std::memory_order_relaxed);
+        result.comparisons = comparisons.load(std::memory_order_relaxed);
+        result.rotations = rotations.load(std::memory_order_relaxed);
+        result.allocations = allocations.load(std::memory_order_relaxed);
+        result.frees = frees.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    void reset() const {
+        nodeVisits.store(0, std::memory_order_relaxed);
+        comparisons.store(0, std::memory_order_relaxed);
+        rotations.store(0, std::memory_order_relaxed);
+        allocations.store(0, std::memory_order_relaxed);
+        frees.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static void add(std::atomic<size_t>& counter, size_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    mutable std::atomic<size_t> nodeVisits;
+    mutable std::atomic<size_t> comparisons;
+    mutable std::atomic<size_t> rotations;
+    mutable std::atomic<size_t> allocations;
+    mutable std::atomic<size_t> frees;
+};
+
+#else
+
+// Without EADS_STATS the counters are an empty member ([[no_unique_address]])
+// and every call compiles to nothing
+class StatsCounters {
+public:
+    void visited(size_t = 1) const { }
+    void compared(size_t = 1) const { }
+    void rotated() const { }
+    void allocated(size_t = 1) const { }
+    void freed(size_t = 1) const { }
+
+    ContainerStats get() const {
+        return ContainerStats();
+    }
+
+    void reset() const { }
+};
+
+#endif
+
+}
+
+#endif
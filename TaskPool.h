@@ -0,0 +1,217 @@
+#ifndef EADS_TASK_POOL_H
+#define EADS_TASK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace eads {
+
+// A fixed set of worker threads for fork-join parallelism. Every worker owns a
+// deque of tasks: it pushes and pops its own at the back and, when idle, steals
+// from the front of the others', so the largest pieces of a divide-and-conquer
+// walk move to idle threads first. Threads outside the pool share one extra
+// deque. A thread waiting for a stolen task runs other tasks meanwhile, so
+// nested forkJoin() calls never deadlock.
+class TaskPool {
+public:
+    explicit TaskPool(size_t workers) : queues(workers + 1), queued(0), stopping(false) {
+        threads.reserve(workers);
+        for (size_t i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i]() { work(i + 1); });
+        }
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator =(const TaskPool&) = delete;
+
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleep);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    size_t workers() const {
+        return threads.size();
+    }
+
+    // One worker per hardware thread besides the caller, and at least one. Never
+    // destroyed, so containers destroyed at exit may still use it.
+    static TaskPool& shared() {
+        static TaskPool* pool = new TaskPool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+        return *pool;
+    }
+
+    // Runs left() and right(), left() possibly on another thread, and returns once
+    // both are done. An exception of either is rethrown after both are done.
+    template<typename Left, typename Right>
+    void forkJoin(Left&& left, Right&& right) {
+        if (threads.empty()) {
+            left();
+            right();
+            return;
+        }
+        Task task(left);
+        size_t self = currentQueue();
+        push(queues[self], &task);
+        std::exception_ptr error;
+        try {
+            right();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        if (reclaim(queues[self], &task)) {
+            task.run();
+        }
+        else {
+            while (!task.done.load(std::memory_order_acquire)) {
+                if (!runOne(self)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        if (task.error) {
+            std::rethrow_exception(task.error);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    // A forked call; it lives on the stack of the forkJoin() which waits for it
+    struct Task {
+        template<typename F>
+        explicit Task(F& f) : body(&call<F>), arg(&f), done(false) { }
+
+        template<typename F>
+        static void call(void* f) {
+            (*static_cast<F*>(f))();
+        }
+
+        void run() {
+            try {
+                body(arg);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            done.store(true, std::memory_order_release);
+        }
+
+        void (*body)(void*);
+        void* arg;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    // The pool and deque of the calling thread, if it is a worker
+    struct Worker {
+        const TaskPool* pool = nullptr;
+        size_t queue = 0;
+    };
+
+    static Worker& worker() {
+        thread_local Worker w;
+        return w;
+    }
+
+    size_t currentQueue() const {
+        return worker().pool == this ? worker().queue : 0;
+    }
+
+    void push(Queue& q, Task* task) {
+        {
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.tasks.push_back(task);
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> guard(sleep);
+        }
+        wake.notify_one();
+    }
+
+    // Takes the task back unless another thread took it; usually it is the last one pushed
+    bool reclaim(Queue& q, Task* task) {
+        std::lock_guard<std::mutex> guard(q.lock);
+        auto it = std::find(q.tasks.rbegin(), q.tasks.rend(), task);
+        if (it == q.tasks.rend()) {
+            return false;
+        }
+        q.tasks.erase(std::next(it).base());
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Task* take(Queue& q, bool newest) {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty()) {
+            return nullptr;
+        }
+        Task* task = newest ? q.tasks.back() : q.tasks.front();
+        if (newest) {
+            q.tasks.pop_back();
+        }
+        else {
+            q.tasks.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    // Runs the newest task of the own deque, or else the oldest one of another
+    bool runOne(size_t self) {
+        Task* task = take(queues[self], true);
+        for (size_t i = 1; task == nullptr && i < queues.size(); ++i) {
+            task = take(queues[(self + i) % queues.size()], false);
+        }
+        if (task == nullptr) {
+            return false;
+        }
+        task->run();
+        return true;
+    }
+
+    void work(size_t self) {
+        worker().pool = this;
+        worker().queue = self;
+        while (true) {
+            if (runOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleep);
+            wake.wait(guard, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    std::vector<Queue> queues;       // queues[0] is shared by the threads outside the pool
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued;      // tasks in all deques
+    std::mutex sleep;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+}
+
+#endif